@@ -0,0 +1,257 @@
+/* Copyright (C) 2006 Bradley C. Kuszmaul.
+ * Modified for Cilk++ by Pablo Halpern, May 2009
+ * This code is licensed under the Gnu General Public License (GPL).
+ */
+
+/* mm_bench times mm_loop_serial, mm_loop_parallel and mm_recursive_parallel
+ * on int, float and double matrices for a list of sizes and Cilk worker
+ * counts, and prints one CSV line per run:
+ *
+ *   type,n,impl,workers,ms,gflops,speedup,efficiency,vs_serial
+ *
+ * ms is wall clock time with microsecond resolution.
+ * speedup is the time of the same implementation on 1 worker divided by
+ * its time on this many workers, efficiency is speedup / workers, and
+ * vs_serial is the mm_loop_serial time divided by this time.  Results are
+ * not checked; run mm_loops and mm_recursive with --verify for that.
+ */
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <sys/time.h>
+
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+#include <cilktools/cilkview.h>
+
+#include "mm_serial.h"
+#include "mm_loops.h"
+#include "mm_recursive.h"
+
+typedef enum { LOOP_SERIAL, LOOP_PARALLEL, RECURSIVE_PARALLEL } Impl;
+
+const char *impl_names[] = {
+    "mm_loop_serial", "mm_loop_parallel", "mm_recursive_parallel"
+};
+
+template <typename T>
+void run_impl(Impl impl, T *C, const T *A, const T *B, int n)
+{
+    switch (impl)
+    {
+    case LOOP_SERIAL:        mm_loop_serial(C,A,B,n);        break;
+    case LOOP_PARALLEL:      mm_loop_parallel(C,A,B,n);      break;
+    case RECURSIVE_PARALLEL: mm_recursive_parallel(C,A,B,n); break;
+    }
+}
+
+/* Restart the Cilk runtime with p workers. */
+bool set_workers(int p)
+{
+    char buf[16];
+    std::sprintf(buf, "%d", p);
+    __cilkrts_end_cilk();
+    return __cilkrts_set_param("nworkers", buf) == 0;
+}
+
+/* Wall clock time in ms, to the microsecond.  cilkview only reports
+ * whole milliseconds, too coarse for the small sizes. */
+double wall_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1.0e3 + tv.tv_usec * 1.0e-3;
+}
+
+/* Restart the Cilk runtime with 1 worker, exiting if that fails: the
+ * speedups are all relative to the 1 worker times. */
+void set_one_worker()
+{
+    if (!set_workers(1))
+    {
+        std::fprintf(stderr, "mm_bench: can't run on 1 worker\n");
+        std::exit(1);
+    }
+}
+
+/* Best time in ms of trials runs of impl on C = 0 + A*B. */
+template <typename T>
+double time_impl(Impl impl, T *C, const T *A, const T *B, int n,
+                 int trials)
+{
+    double best = -1;
+    for (int t=0; t<trials; t++)
+    {
+        std::fill(C, C + n*n, T(0));
+        double start = wall_ms();
+        run_impl(impl, C, A, B, n);
+        double ms = wall_ms() - start;
+        if (best < 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+/* ratio of two times in ms, 0 if the divisor was too short to time */
+double ratio(double a, double b)
+{
+    return b > 0 ? a / b : 0;
+}
+
+void print_row(const char *type_name, int n, Impl impl, int p,
+               double ms, double ms1, double ms_serial)
+{
+    double speedup = ratio(ms1, ms);
+    std::printf("%s,%d,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                type_name, n, impl_names[impl], p, ms,
+                ms > 0 ? 2.0 * n * n * n / (ms * 1.0e6) : 0.0,
+                speedup, speedup / p, ratio(ms_serial, ms));
+    std::fflush(stdout);
+}
+
+template <typename T>
+void bench_type(const char *type_name, const std::vector<int> &sizes,
+                const std::vector<int> &workers, int trials)
+{
+    for (size_t s=0; s<sizes.size(); s++)
+    {
+        int n = sizes[s];
+        T *A = new T[n*n];
+        T *B = new T[n*n];
+        T *C = new T[n*n];
+        for (int i=0; i<n*n; i++)
+        {
+            // Small values keep int sums from overflowing.
+            A[i] = T(std::rand() & 0xff);
+            B[i] = T(std::rand() & 0xff);
+        }
+
+        set_one_worker();
+        double ms_serial = time_impl(LOOP_SERIAL, C, A, B, n, trials);
+        print_row(type_name, n, LOOP_SERIAL, 1, ms_serial, ms_serial,
+                  ms_serial);
+
+        const Impl parallel[] = { LOOP_PARALLEL, RECURSIVE_PARALLEL };
+        for (int k=0; k<2; k++)
+        {
+            set_one_worker();
+            double ms1 = time_impl(parallel[k], C, A, B, n, trials);
+            for (size_t w=0; w<workers.size(); w++)
+            {
+                double ms = ms1;
+                if (workers[w] != 1)
+                {
+                    // Skip the row rather than label it with the wrong
+                    // worker count
+                    if (!set_workers(workers[w]))
+                    {
+                        std::fprintf(stderr, "mm_bench: can't run on %d "
+                                     "workers, skipping\n", workers[w]);
+                        continue;
+                    }
+                    ms = time_impl(parallel[k], C, A, B, n, trials);
+                }
+                print_row(type_name, n, parallel[k], workers[w], ms, ms1,
+                          ms_serial);
+            }
+        }
+
+        delete [] C;
+        delete [] B;
+        delete [] A;
+    }
+}
+
+/* Parse a comma separated list of positive integers. */
+bool parse_list(const char *s, std::vector<int> &out)
+{
+    out.clear();
+    while (*s)
+    {
+        char *next;
+        long v = std::strtol(s, &next, 10);
+        if (next == s || v <= 0)
+            return false;
+        out.push_back(int(v));
+        s = next;
+        if (*s == ',')
+            s++;
+    }
+    return !out.empty();
+}
+
+/* The arguments to mm_bench:
+ *   --sizes=N1,N2,...      matrix sizes (default 256,512,1024)
+ *   --workers=P1,P2,...    worker counts (default 1, 2, 4, ... up to the
+ *                          number of workers Cilk starts with)
+ *   --types=int,float,double
+ *                          element types (default all three)
+ *   --trials=T             report the best of T runs (default 1)
+ */
+int main (int argc, char *argv[])
+{
+    std::vector<int> sizes, workers;
+    bool do_int=true, do_float=true, do_double=true;
+    int trials = 1;
+
+    sizes.push_back(256);
+    sizes.push_back(512);
+    sizes.push_back(1024);
+    for (int p=1; p<=__cilkrts_get_nworkers(); p*=2)
+        workers.push_back(p);
+
+    for (int i=1; i<argc; i++)
+    {
+        char *arg = argv[i];
+        if (std::strncmp(arg,"--sizes=",8)==0)
+        {
+            if (!parse_list(arg+8, sizes))
+            {
+                std::cout << "Illegal option: " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strncmp(arg,"--workers=",10)==0)
+        {
+            if (!parse_list(arg+10, workers))
+            {
+                std::cout << "Illegal option: " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strncmp(arg,"--types=",8)==0)
+        {
+            do_int = std::strstr(arg+8, "int") != NULL;
+            do_float = std::strstr(arg+8, "float") != NULL;
+            do_double = std::strstr(arg+8, "double") != NULL;
+        }
+        else if (std::strncmp(arg,"--trials=",9)==0)
+        {
+            trials = std::atoi(arg+9);
+            if (trials <= 0)
+            {
+                std::cout << "Illegal option: " << arg << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            std::cout << "unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    std::printf("type,n,impl,workers,ms,gflops,speedup,efficiency,vs_serial\n");
+    if (do_int)
+        bench_type<int>("int", sizes, workers, trials);
+    if (do_float)
+        bench_type<float>("float", sizes, workers, trials);
+    if (do_double)
+        bench_type<double>("double", sizes, workers, trials);
+
+    return 0;
+}
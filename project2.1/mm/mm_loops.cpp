@@ -24,36 +24,14 @@
 #include <iostream>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
+#include <algorithm>
 
 #include <cilk/cilk.h>
 #include <cilktools/cilkview.h>
 
-/* mm_loop_serial is the standard triply nested loop implementation.
- *   C += A*B
- * n is the matrix size.  Note that C is not set to zero -- its initial value
- * is added to the matrix-product of B and C */
-template <typename T>
-void mm_loop_serial(T *C, const T *A, const T *B, int n)
-{
-    /* DO NOT MODIFY THIS CODE.  THIS IS USED TO VERIFY THAT YOUR
-     * CODE IS PRODUCING THE RIGHT ANSWER. */
-    for (int i=0; i<n; i++)
-        for (int j=0; j<n; j++)
-            for (int k=0; k<n; k++)
-                C[i*n+j] += A[i*n+k] * B[k*n+j];
-}
-
-/* mm_loop_parallel is the parallel implementation of mm_loop_serial */
-template <typename T>
-void mm_loop_parallel(T *C, const T *A, const T *B, int n)
-{
-    /* MODIFY THIS CODE TO MAKE IT PARALLEL */
-    for (int i=0; i<n; i++)
-        cilk_for (int j=0; j<n; j++)
-            for (int k=0; k<n; k++)
-                C[i*n+j] += A[i*n+k] * B[k*n+j];
-}
-
+#include "mm_serial.h"
+#include "mm_loops.h"
 
 /* Here are some tests. */
 
@@ -177,26 +155,45 @@ void random_test(int n, const char *test_name, bool verify, bool timer)
     delete [] a;
 }
 
-/* return true iff n = 2^k. */
-bool is_power_of_2 (int n)
+/* Time mm_loop_tiled with square tiles of each size in tiles on an n*n
+ * multiply.  The answer is not checked. */
+void tile_sweep(int n, const int *tiles, int ntiles)
 {
-    bool match = false; /* whether a bit has been matched. */
-    int field = 0x1;    /* field for bit matching. */
-    for (int i = sizeof(int) * 8; i > 0; --i, field <<= 1)
+    double *a = new double[n*n];
+    double *b = new double[n*n];
+    double *c = new double[n*n];
+
+    for (int i=0; i<n*n; i++)
     {
-        if (field & n)
-        {
-            if (match) return false;
-            match = true;
-        }
+        a[i] = (std::rand() & 0x1ffff) / 4.0;
+        b[i] = (std::rand() & 0x1ffff) / 4.0;
     }
-    return match;
+
+    for (int t=0; t<ntiles; t++)
+    {
+        std::fill(c, c + n*n, 0.0);
+        cilkview_data_t start, end;
+        __cilkview_query(start);
+        mm_loop_tiled(c, a, b, n, tiles[t], tiles[t], tiles[t]);
+        __cilkview_query(end);
+        std::cout << "tile_sweep n=" << n << " tile=" << tiles[t]
+                  << " time: " << end.time - start.time << "ms" << std::endl;
+    }
+
+    delete [] c;
+    delete [] b;
+    delete [] a;
 }
 
 /* The arguments to mm:
  *   --verify    run the verification tests.
  *   --notime    don't measure run times.
  *   --pause     pause at the end of the run
+ *   --tile=T or --tile=IxJxK
+ *               tile sizes used by mm_loop_parallel
+ *               (default 64x256x128)
+ *   --sweep     time square tiles from 16 to 512 on
+ *               1024, 2048 and 4096 sized matrices
  *   N           (a number) run a matrix multiply on an
  *               NxN matrix, without checking that the
  *               answer is correct.  If N is absent, run a
@@ -205,7 +202,7 @@ bool is_power_of_2 (int n)
 int main (int argc, char *argv[])
 {
     int N=-1;
-    bool do_verify=false, do_time=true, do_pause=false;
+    bool do_verify=false, do_time=true, do_pause=false, do_sweep=false;
     const char *N_str=NULL;
     while (argc>1)
     {
@@ -222,6 +219,23 @@ int main (int argc, char *argv[])
         {
             do_pause=true;
         }
+        else if (std::strncmp(arg,"--tile=",7)==0)
+        {
+            int fields = std::sscanf(arg+7, "%dx%dx%d",
+                                     &tile_i, &tile_j, &tile_k);
+            if (fields == 1)
+                tile_j = tile_k = tile_i;
+            if ((fields != 1 && fields != 3)
+                || tile_i <= 0 || tile_j <= 0 || tile_k <= 0)
+            {
+                std::cout << "Illegal option: " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(arg,"--sweep")==0)
+        {
+            do_sweep=true;
+        }
         else if ('0'<=arg[0] && arg[0]<='9')
         {
             N_str=arg;
@@ -232,11 +246,6 @@ int main (int argc, char *argv[])
                 std::cout << "Illegal option: " << N_str << std::endl;
                 return 1;
             }
-            else if (!is_power_of_2(N))
-            {
-                std::cout << "N must be a power of 2" << std::endl;
-                return 1;
-            }
         }
         argc--;
     }
@@ -249,7 +258,14 @@ int main (int argc, char *argv[])
     random_test(4,"smoke_test4",true,false);
     random_test(64,"smoke_test64",true,false);
 
-    if (N_str)
+    if (do_sweep)
+    {
+        static const int sizes[] = {1024, 2048, 4096};
+        static const int tiles[] = {16, 32, 64, 128, 256, 512};
+        for (int i=0; i<3; i++)
+            tile_sweep(sizes[i], tiles, 6);
+    }
+    else if (N_str)
     {
         char test_name[25] = "matrix";
         std::strncat(test_name, N_str, 12);
@@ -0,0 +1,65 @@
+/* Copyright (C) 2006 Bradley C. Kuszmaul.
+ * Modified for Cilk++ by Pablo Halpern, May 2009
+ * This code is licensed under the Gnu General Public License (GPL).
+ */
+
+/* Parallel loop matrix multiply, used by mm_loops and mm_bench.
+ * Matrices are laid out in row-major order. */
+
+#ifndef MM_LOOPS_H
+#define MM_LOOPS_H
+
+#include <algorithm>
+
+#include <cilk/cilk.h>
+
+/* Tile sizes used by mm_loop_parallel.  Set with --tile. */
+static int tile_i = 64;
+static int tile_j = 256;
+static int tile_k = 128;
+
+/* mm_tile multiplies one block:
+ *   C[i0..i1)[j0..j1) += A[i0..i1)[k0..k1) * B[k0..k1)[j0..j1)
+ * in i-k-j order, so the inner loop runs along rows of B and C. */
+template <typename T>
+inline void mm_tile(T *C, const T *A, const T *B, int n,
+                    int i0, int i1, int j0, int j1, int k0, int k1)
+{
+    for (int i=i0; i<i1; i++)
+        for (int k=k0; k<k1; k++)
+        {
+            const T a = A[i*n+k];
+            for (int j=j0; j<j1; j++)
+                C[i*n+j] += a * B[k*n+j];
+        }
+}
+
+/* mm_loop_tiled splits C into ti x tj output tiles and computes the tiles
+ * in parallel.  Each tile walks k in steps of tk so that the panels of A
+ * and B it reads stay in cache.  The tiles never share output, so no
+ * two strands write the same element of C. */
+template <typename T>
+void mm_loop_tiled(T *C, const T *A, const T *B, int n,
+                   int ti, int tj, int tk)
+{
+    const int ntiles_i = (n + ti - 1) / ti;
+    const int ntiles_j = (n + tj - 1) / tj;
+    cilk_for (int t=0; t<ntiles_i*ntiles_j; t++)
+    {
+        const int i0 = (t / ntiles_j) * ti;
+        const int j0 = (t % ntiles_j) * tj;
+        const int i1 = std::min(i0 + ti, n);
+        const int j1 = std::min(j0 + tj, n);
+        for (int k0=0; k0<n; k0+=tk)
+            mm_tile(C, A, B, n, i0, i1, j0, j1, k0, std::min(k0 + tk, n));
+    }
+}
+
+/* mm_loop_parallel is the parallel implementation of mm_loop_serial */
+template <typename T>
+void mm_loop_parallel(T *C, const T *A, const T *B, int n)
+{
+    mm_loop_tiled(C, A, B, n, tile_i, tile_j, tile_k);
+}
+
+#endif // MM_LOOPS_H
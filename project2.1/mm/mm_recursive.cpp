@@ -24,112 +24,22 @@
 #include <iostream>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
+#include <algorithm>
 
 #include <cilk/cilk.h>
 #include <cilktools/cilkview.h>
 
-// Uncomment this line to use loops for the small matrix base case
-#define USE_LOOPS_FOR_SMALL_MATRICES
-
-/* mm_loop_serial is the standard triply nested loop implementation.
- *   C += A*B
- * n is the matrix size.  Note that C is not set to zero -- its initial value
- * is added to the matrix-product of B and C */
-template <typename T>
-void mm_loop_serial(T *C, const T *A, const T *B, int n)
-{
-    /* DO NOT MODIFY THIS CODE.  THIS IS USED TO VERIFY THAT YOUR
-     * CODE IS PRODUCING THE RIGHT ANSWER. */
-    for (int i=0; i<n; i++)
-        for (int j=0; j<n; j++)
-            for (int k=0; k<n; k++)
-                C[i*n+j] += A[i*n+k] * B[k*n+j];
-}
-
-/* mm_internal is the recursive implementation of matrix multiply.
- * This code will not work on non-square matrices. */
-template <typename T>
-void mm_internal (T *C, const T *A, const T *B, int n, int length)
-/* Effect: Compute
- *    C+=A*B,
- * where C, A, and B are the starting addresses of submatrices of n-by-n
- * matrices, each with dimension length x length.
- * The rows of C, A, and B, each contain n elements.
- */
-{
-    static const int threshold = 16;
-
-    /* Base cases */
-    if (length == 0)
-    {
-        return;
-    }
-    else if (length == 1) {
-        C[0] += A[0] * B[0];
-    }
-#ifdef USE_LOOPS_FOR_SMALL_MATRICES
-    else if (length < threshold)
-    {
-        // Use a loop for small matrices
-        for (int i=0; i<length; i++)
-            for (int j=0; j<length; j++)
-                for (int k=0; k<length; k++)
-                    C[i*n+j] += A[i*n+k] * B[k*n+j];
-    }
-#endif // USE_LOOPS_FOR_SMALL_MATRICES
-    else
-    {
-        /* Partition the matrices */
-        int mid = length / 2;
-
-        T       *C11 = C              ;
-        T       *C12 = C         + mid;
-        T       *C21 = C + n*mid      ;
-        T       *C22 = C + n*mid + mid;
-
-        T const *A11 = A              ;
-        T const *A12 = A         + mid;
-        T const *A21 = A + n*mid      ;
-        T const *A22 = A + n*mid + mid;
-
-        T const *B11 = B              ;
-        T const *B12 = B         + mid;
-        T const *B21 = B + n*mid      ;
-        T const *B22 = B + n*mid + mid;
-
-/************************************************************
- *               COMPLETE THE CODE BELOW                    *
- ************************************************************/
-        cilk_spawn mm_internal(C11, A11, B11, n, mid);
-        cilk_spawn mm_internal(C21, A21, B11, n, mid);
-        cilk_spawn mm_internal(C12, A11, B12, n, mid);
-        cilk_spawn mm_internal(C22, A21, B12, n, mid);
-        cilk_sync;
-        cilk_spawn mm_internal(C11, A12, B21, n, mid);
-        cilk_spawn mm_internal(C21, A22, B21, n, mid);
-        cilk_spawn mm_internal(C12, A12, B22, n, mid);
-        cilk_spawn mm_internal(C22, A22, B22, n, mid);
-        cilk_sync;
-
-    }
-}
-
-/* This is the public interface to mm_internal. */
-template <typename T>
-void mm_recursive_parallel(T *C, const T *A, const T *B, int n)
-/* Effect:  C, A, and B are n*n matrices of Ts.
- * Perform
- *   C += A * B.
- */
-{
-    mm_internal(C,A,B,n,n);
-}
-
+#include "mm_serial.h"
+#include "mm_recursive.h"
 
 /* Here are some tests. */
 
 int test_status = 0;
 
+/* Run test_mm through the Morton layout.  Set with --morton. */
+bool use_morton = false;
+
 template <typename T>
 void copy_matrix(T *dest, const T *src, int n)
 {
@@ -146,6 +56,15 @@ bool are_equal_matrices(const T *a, const T *b, int n)
     return true;
 }
 
+/* Billions of floating point operations per second for an m*k times k*n
+ * multiply that took ms milliseconds (0 if it was too fast to time). */
+double gflops(int m, int k, int n, long long ms)
+{
+    if (ms <= 0)
+        return 0;
+    return 2.0 * m * k * n / (ms * 1.0e6);
+}
+
 // Test to see if mm_recursive_parallel and mm_loop_serial do the same thing.
 template <typename T>
 void test_mm(const T *C, const T *A, const T *B, int n,
@@ -154,7 +73,39 @@ void test_mm(const T *C, const T *A, const T *B, int n,
     T *Cp = new T[n*n];
     copy_matrix(Cp, C, n);
 
-    if (timer)
+    if (use_morton && is_power_of_2(n))
+    {
+        /* Time the multiply on its own and with the layout conversion. */
+        int block = morton_block(n);
+        T *Cm = new T[n*n];
+        T *Am = new T[n*n];
+        T *Bm = new T[n*n];
+        cilkview_data_t start, convert, multiply, end;
+        __cilkview_query(start);
+        cilk_spawn to_morton(Am, A, n, n, block);
+        cilk_spawn to_morton(Bm, B, n, n, block);
+        to_morton(Cm, Cp, n, n, block);
+        cilk_sync;
+        __cilkview_query(convert);
+        mm_morton(Cm, Am, Bm, n, block);
+        __cilkview_query(multiply);
+        from_morton(Cp, Cm, n, n, block);
+        __cilkview_query(end);
+        if (timer)
+        {
+            __cilkview_do_report(&start, &end,(char *) test_name, CV_REPORT_WRITE_TO_LOG | CV_REPORT_WRITE_TO_RESULTS);
+            long long kernel = multiply.time - convert.time;
+            std::cout << test_name << " time: " << end.time - start.time
+                      << "ms (" << gflops(n, n, n, end.time - start.time)
+                      << " GFLOPS) with Morton conversion, " << kernel
+                      << "ms (" << gflops(n, n, n, kernel)
+                      << " GFLOPS) without" << std::endl;
+        }
+        delete [] Bm;
+        delete [] Am;
+        delete [] Cm;
+    }
+    else if (timer)
     {
         cilkview_data_t start, end;
         __cilkview_query(start);
@@ -163,7 +114,8 @@ void test_mm(const T *C, const T *A, const T *B, int n,
         __cilkview_query(end);
         __cilkview_do_report(&start, &end,(char *) test_name, CV_REPORT_WRITE_TO_LOG | CV_REPORT_WRITE_TO_RESULTS);
         std::cout << test_name << " time: " << end.time - start.time
-                  << "ms" << std::endl;
+                  << "ms (" << gflops(n, n, n, end.time - start.time)
+                  << " GFLOPS)" << std::endl;
     }
     else
         mm_recursive_parallel(Cp,A,B,n);
@@ -223,6 +175,67 @@ void smoke_test2()
     }
 }
 
+/* mm_loop_serial for an m*k A and a k*n B, used to check mm_general. */
+template <typename T>
+void mm_loop_serial_general(T *C, const T *A, const T *B, int m, int k, int n)
+{
+    for (int i=0; i<m; i++)
+        for (int j=0; j<n; j++)
+            for (int l=0; l<k; l++)
+                C[i*n+j] += A[i*k+l] * B[l*n+j];
+}
+
+/* Test mm_recursive_general on an m*k times k*n product. */
+void rect_test(int m, int k, int n, const char *test_name, bool verify,
+               bool timer)
+{
+    double *a = new double[m*k];
+    double *b = new double[k*n];
+    double *c = new double[m*n];
+    double *cp = new double[m*n];
+
+    for (int i=0; i<m*k; i++)
+        a[i] = (std::rand() & 0x1ffff) / 4.0;
+    for (int i=0; i<k*n; i++)
+        b[i] = (std::rand() & 0x1ffff) / 4.0;
+    for (int i=0; i<m*n; i++)
+        cp[i] = c[i] = (std::rand() & 0x1ffff) / 4.0;
+
+    if (timer)
+    {
+        cilkview_data_t start, end;
+        __cilkview_query(start);
+        mm_recursive_general(cp,a,b,m,k,n);
+        __cilkview_query(end);
+        __cilkview_do_report(&start, &end,(char *) test_name, CV_REPORT_WRITE_TO_LOG | CV_REPORT_WRITE_TO_RESULTS);
+        std::cout << test_name << " time: " << end.time - start.time
+                  << "ms (" << gflops(m, k, n, end.time - start.time)
+                  << " GFLOPS)" << std::endl;
+    }
+    else
+        mm_recursive_general(cp,a,b,m,k,n);
+
+    if (verify)
+    {
+        mm_loop_serial_general(c,a,b,m,k,n);
+        for (int i=0; i<m*n; i++)
+        {
+            if (c[i] != cp[i])
+            {
+                std::cout << ">>>>> " << test_name << " failed <<<<<"
+                          << std::endl;
+                ++test_status;
+                break;
+            }
+        }
+    }
+
+    delete [] cp;
+    delete [] c;
+    delete [] b;
+    delete [] a;
+}
+
 /* A bigger test. */
 void random_test(int n, const char *test_name, bool verify, bool timer)
 {
@@ -245,34 +258,25 @@ void random_test(int n, const char *test_name, bool verify, bool timer)
     delete [] a;
 }
 
-/* return true iff n = 2^k. */
-bool is_power_of_2 (int n)
-{
-    bool match = false; /* whether a bit has been matched. */
-    int field = 0x1;    /* field for bit matching. */
-    for (int i = sizeof(int) * 8; i > 0; --i, field <<= 1)
-    {
-        if (field & n)
-        {
-            if (match) return false;
-            match = true;
-        }
-    }
-    return match;
-}
-
 /* The arguments to mm:
  *   --verify    run the verification tests.
  *   --notime    don't measure run times.
  *   --pause     pause at the end of the run
+ *   --threshold=T  use the base case for submatrices smaller than T
+ *   --nosimd    use the scalar base case instead of the packed
+ *               SIMD kernel
+ *   --morton    convert power of 2 matrices to a blocked Morton
+ *               layout before multiplying
  *   N           (a number) run a matrix multiply on an
  *               NxN matrix, without checking that the
  *               answer is correct.  If N is absent, run a
  *               a standard test suite.
+ *   MxKxN       run a multiply of an MxK matrix by a KxN
+ *               matrix instead.
  */
 int main (int argc, char *argv[])
 {
-    int N=-1;
+    int N=-1, M=-1, K=-1;
     bool do_verify=false, do_time=true, do_pause=false;
     const char *N_str=NULL;
     while (argc>1)
@@ -290,6 +294,33 @@ int main (int argc, char *argv[])
         {
             do_pause=true;
         }
+        else if (std::strncmp(arg,"--threshold=",12)==0)
+        {
+            mm_threshold = std::atoi(arg+12);
+            if (mm_threshold < 2)
+            {
+                std::cout << "Illegal option: " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(arg,"--nosimd")==0)
+        {
+            mm_use_simd=false;
+        }
+        else if (std::strcmp(arg,"--morton")==0)
+        {
+            use_morton=true;
+        }
+        else if ('0'<=arg[0] && arg[0]<='9' && std::strchr(arg,'x'))
+        {
+            N_str=arg;
+            if (std::sscanf(arg, "%dx%dx%d", &M, &K, &N) != 3
+                || M <= 0 || K <= 0 || N <= 0)
+            {
+                std::cout << "Illegal option: " << N_str << std::endl;
+                return 1;
+            }
+        }
         else if ('0'<=arg[0] && arg[0]<='9')
         {
             N_str=arg;
@@ -300,11 +331,6 @@ int main (int argc, char *argv[])
                 std::cout << "Illegal option: " << N_str << std::endl;
                 return 1;
             }
-            else if (!is_power_of_2(N))
-            {
-                std::cout << "N must be a power of 2" << std::endl;
-                return 1;
-            }
         }
         else
         {
@@ -321,12 +347,20 @@ int main (int argc, char *argv[])
     /* The third arg says verify the answer.  */
     random_test(4,"smoke_test4",true,false);
     random_test(64,"smoke_test64",true,false);
+    random_test(100,"smoke_test100",true,false);
+    rect_test(3,5,7,"smoke_test3x5x7",true,false);
+    rect_test(129,1,65,"smoke_test129x1x65",true,false);
+    rect_test(33,257,17,"smoke_test33x257x17",true,false);
+    rect_test(97,83,131,"smoke_test97x83x131",true,false);
 
     if (N_str)
     {
         char test_name[25] = "matrix";
         std::strncat(test_name, N_str, 12);
-        random_test(N, test_name, do_verify, do_time);
+        if (M > 0)
+            rect_test(M, K, N, test_name, do_verify, do_time);
+        else
+            random_test(N, test_name, do_verify, do_time);
     }
     else
     {
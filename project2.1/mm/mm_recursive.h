@@ -0,0 +1,461 @@
+/* Copyright (C) 2006 Bradley C. Kuszmaul.
+ * Modified for Cilk++ by Pablo Halpern, May 2009
+ * This code is licensed under the Gnu General Public License (GPL).
+ */
+
+/* Recursive divide-and-conquer matrix multiply, used by mm_recursive and
+ * mm_bench.  Matrices are laid out in row-major order. */
+
+#ifndef MM_RECURSIVE_H
+#define MM_RECURSIVE_H
+
+#include <algorithm>
+
+#include <cilk/cilk.h>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define HAVE_SIMD_KERNEL
+#endif
+
+// Uncomment this line to use loops for the small matrix base case
+#define USE_LOOPS_FOR_SMALL_MATRICES
+
+/* Submatrices shorter than this are multiplied by mm_base.
+ * Set with --threshold=N. */
+static int mm_threshold = 64;
+
+/* Whether mm_base uses the packed SIMD kernel for float and double.
+ * Cleared with --nosimd. */
+static bool mm_use_simd = true;
+
+/* mm_base multiplies the small submatrices at the leaves of mm_internal.
+ *   C += A*B
+ * where C, A, and B are length x length with rows n elements apart.
+ * This generic version uses the i-k-j order so that the inner loop walks
+ * rows of B and C with unit stride. */
+template <typename T>
+void mm_base(T *C, const T *A, const T *B, int n, int length)
+{
+    for (int i=0; i<length; i++)
+        for (int k=0; k<length; k++)
+            for (int j=0; j<length; j++)
+                C[i*n+j] += A[i*n+k] * B[k*n+j];
+}
+
+#ifdef HAVE_SIMD_KERNEL
+/* AVX2 vector operations for the packed kernel. */
+template <typename T> struct simd;
+
+template <> struct simd<double>
+{
+    typedef __m256d vec;
+    enum { width = 4 };
+    static vec zero() { return _mm256_setzero_pd(); }
+    static vec load(const double *p) { return _mm256_load_pd(p); }
+    static vec broadcast(const double *p) { return _mm256_broadcast_sd(p); }
+    static vec fmadd(vec a, vec b, vec c) { return _mm256_fmadd_pd(a,b,c); }
+    static void store(double *p, vec v) { _mm256_store_pd(p,v); }
+};
+
+template <> struct simd<float>
+{
+    typedef __m256 vec;
+    enum { width = 8 };
+    static vec zero() { return _mm256_setzero_ps(); }
+    static vec load(const float *p) { return _mm256_load_ps(p); }
+    static vec broadcast(const float *p) { return _mm256_broadcast_ss(p); }
+    static vec fmadd(vec a, vec b, vec c) { return _mm256_fmadd_ps(a,b,c); }
+    static void store(float *p, vec v) { _mm256_store_ps(p,v); }
+};
+
+/* Pack buffer of mm_base_packed for each worker thread, grown as needed
+ * and kept for the life of the thread.  A leaf multiply doesn't spawn, so
+ * a worker only ever has one using the buffer. */
+static __thread void *mm_pack_buffer = NULL;
+static __thread size_t mm_pack_bytes = 0;
+
+/* Return the calling worker's pack buffer grown to at least bytes bytes,
+ * 32-byte aligned, or NULL if it can't be allocated. */
+inline void *mm_pack_space(size_t bytes)
+{
+    if (bytes > mm_pack_bytes)
+    {
+        _mm_free(mm_pack_buffer);
+        mm_pack_buffer = _mm_malloc(bytes, 32);
+        mm_pack_bytes = mm_pack_buffer ? bytes : 0;
+    }
+    return mm_pack_buffer;
+}
+
+/* mm_base_packed is mm_base for float and double.  A is copied into
+ * slivers of MR rows and B into slivers of NR columns, each stored k-major
+ * and zero padded, so the MR x NR micro-kernel below streams through both
+ * with unit stride and keeps its block of C in registers. */
+template <typename T>
+void mm_base_packed(T *C, const T *A, const T *B, int n, int length)
+{
+    typedef simd<T> V;
+    typedef typename V::vec vec;
+    enum { MR = 4, NR = 2 * V::width };
+
+    const int mslivers = (length + MR - 1) / MR;
+    const int nslivers = (length + NR - 1) / NR;
+    /* Bp starts on a 32-byte boundary after Ap */
+    const size_t asize = ((size_t) mslivers * MR * length + 7) & ~(size_t) 7;
+    const size_t bsize = (size_t) nslivers * NR * length;
+    T *Ap = (T *) mm_pack_space(sizeof(T) * (asize + bsize));
+    if (Ap == NULL)
+    {
+        mm_base<T>(C, A, B, n, length);
+        return;
+    }
+    T *Bp = Ap + asize;
+
+    for (int s=0; s<mslivers; s++)
+        for (int k=0; k<length; k++)
+            for (int r=0; r<MR; r++)
+            {
+                int i = s*MR + r;
+                Ap[(s*length + k)*MR + r] = i < length ? A[i*n+k] : T(0);
+            }
+    for (int t=0; t<nslivers; t++)
+        for (int k=0; k<length; k++)
+            for (int c=0; c<NR; c++)
+            {
+                int j = t*NR + c;
+                Bp[(t*length + k)*NR + c] = j < length ? B[k*n+j] : T(0);
+            }
+
+    T block[MR*NR] __attribute__((aligned(32)));
+    for (int s=0; s<mslivers; s++)
+    {
+        for (int t=0; t<nslivers; t++)
+        {
+            const T *a = Ap + s*length*MR;
+            const T *b = Bp + t*length*NR;
+            vec c00 = V::zero(), c01 = V::zero();
+            vec c10 = V::zero(), c11 = V::zero();
+            vec c20 = V::zero(), c21 = V::zero();
+            vec c30 = V::zero(), c31 = V::zero();
+            for (int k=0; k<length; k++, a += MR, b += NR)
+            {
+                vec b0 = V::load(b);
+                vec b1 = V::load(b + V::width);
+                vec a0 = V::broadcast(a);
+                c00 = V::fmadd(a0, b0, c00);
+                c01 = V::fmadd(a0, b1, c01);
+                vec a1 = V::broadcast(a + 1);
+                c10 = V::fmadd(a1, b0, c10);
+                c11 = V::fmadd(a1, b1, c11);
+                vec a2 = V::broadcast(a + 2);
+                c20 = V::fmadd(a2, b0, c20);
+                c21 = V::fmadd(a2, b1, c21);
+                vec a3 = V::broadcast(a + 3);
+                c30 = V::fmadd(a3, b0, c30);
+                c31 = V::fmadd(a3, b1, c31);
+            }
+            V::store(block,                  c00);
+            V::store(block + V::width,       c01);
+            V::store(block + NR,             c10);
+            V::store(block + NR + V::width,  c11);
+            V::store(block + 2*NR,           c20);
+            V::store(block + 2*NR + V::width, c21);
+            V::store(block + 3*NR,           c30);
+            V::store(block + 3*NR + V::width, c31);
+
+            /* Add the block into C, skipping the zero padding. */
+            int rows = std::min((int) MR, length - s*MR);
+            int cols = std::min((int) NR, length - t*NR);
+            T *Cblock = C + s*MR*n + t*NR;
+            for (int r=0; r<rows; r++)
+                for (int c=0; c<cols; c++)
+                    Cblock[r*n+c] += block[r*NR+c];
+        }
+    }
+
+}
+
+inline void mm_base(double *C, const double *A, const double *B, int n, int length)
+{
+    if (mm_use_simd)
+        mm_base_packed(C, A, B, n, length);
+    else
+        mm_base<double>(C, A, B, n, length);
+}
+
+inline void mm_base(float *C, const float *A, const float *B, int n, int length)
+{
+    if (mm_use_simd)
+        mm_base_packed(C, A, B, n, length);
+    else
+        mm_base<float>(C, A, B, n, length);
+}
+#endif // HAVE_SIMD_KERNEL
+
+/* mm_internal is the recursive implementation of matrix multiply.
+ * This code will not work on non-square matrices. */
+template <typename T>
+void mm_internal (T *C, const T *A, const T *B, int n, int length)
+/* Effect: Compute
+ *    C+=A*B,
+ * where C, A, and B are the starting addresses of submatrices of n-by-n
+ * matrices, each with dimension length x length.
+ * The rows of C, A, and B, each contain n elements.
+ */
+{
+    /* Base cases */
+    if (length == 0)
+    {
+        return;
+    }
+    else if (length == 1) {
+        C[0] += A[0] * B[0];
+    }
+#ifdef USE_LOOPS_FOR_SMALL_MATRICES
+    else if (length < mm_threshold)
+    {
+        // Use a loop for small matrices
+        mm_base(C, A, B, n, length);
+    }
+#endif // USE_LOOPS_FOR_SMALL_MATRICES
+    else
+    {
+        /* Partition the matrices */
+        int mid = length / 2;
+
+        T       *C11 = C              ;
+        T       *C12 = C         + mid;
+        T       *C21 = C + n*mid      ;
+        T       *C22 = C + n*mid + mid;
+
+        T const *A11 = A              ;
+        T const *A12 = A         + mid;
+        T const *A21 = A + n*mid      ;
+        T const *A22 = A + n*mid + mid;
+
+        T const *B11 = B              ;
+        T const *B12 = B         + mid;
+        T const *B21 = B + n*mid      ;
+        T const *B22 = B + n*mid + mid;
+
+/************************************************************
+ *               COMPLETE THE CODE BELOW                    *
+ ************************************************************/
+        cilk_spawn mm_internal(C11, A11, B11, n, mid);
+        cilk_spawn mm_internal(C21, A21, B11, n, mid);
+        cilk_spawn mm_internal(C12, A11, B12, n, mid);
+        cilk_spawn mm_internal(C22, A21, B12, n, mid);
+        cilk_sync;
+        cilk_spawn mm_internal(C11, A12, B21, n, mid);
+        cilk_spawn mm_internal(C21, A22, B21, n, mid);
+        cilk_spawn mm_internal(C12, A12, B22, n, mid);
+        cilk_spawn mm_internal(C22, A22, B22, n, mid);
+        cilk_sync;
+
+    }
+}
+
+/* Blocked Morton (Z-order) layout.  A length x length matrix (length a
+ * power of 2) is stored as its four quadrants one after another in the
+ * order 11, 12, 21, 22, each laid out the same way recursively, down to
+ * block x block tiles that are stored row-major.  Every submatrix the
+ * recursion visits is then one contiguous piece of memory. */
+
+/* Copy the length x length submatrix src (rows n elements apart) into
+ * dst in blocked Morton order. */
+template <typename T>
+void to_morton(T *dst, const T *src, int n, int length, int block)
+{
+    if (length <= block)
+    {
+        for (int i=0; i<length; i++)
+            for (int j=0; j<length; j++)
+                dst[i*length+j] = src[i*n+j];
+        return;
+    }
+    int mid = length / 2;
+    int q = mid * mid;
+    cilk_spawn to_morton(dst,       src,             n, mid, block);
+    cilk_spawn to_morton(dst + q,   src + mid,       n, mid, block);
+    cilk_spawn to_morton(dst + 2*q, src + n*mid,     n, mid, block);
+    to_morton(dst + 3*q, src + n*mid + mid, n, mid, block);
+    cilk_sync;
+}
+
+/* Inverse of to_morton. */
+template <typename T>
+void from_morton(T *dst, const T *src, int n, int length, int block)
+{
+    if (length <= block)
+    {
+        for (int i=0; i<length; i++)
+            for (int j=0; j<length; j++)
+                dst[i*n+j] = src[i*length+j];
+        return;
+    }
+    int mid = length / 2;
+    int q = mid * mid;
+    cilk_spawn from_morton(dst,             src,       n, mid, block);
+    cilk_spawn from_morton(dst + mid,       src + q,   n, mid, block);
+    cilk_spawn from_morton(dst + n*mid,     src + 2*q, n, mid, block);
+    from_morton(dst + n*mid + mid, src + 3*q, n, mid, block);
+    cilk_sync;
+}
+
+/* mm_morton is mm_internal for matrices in blocked Morton order.
+ *    C+=A*B,
+ * where C, A, and B are length x length and tiles are block x block. */
+template <typename T>
+void mm_morton (T *C, const T *A, const T *B, int length, int block)
+{
+    if (length <= block)
+    {
+        mm_base(C, A, B, length, length);
+        return;
+    }
+
+    int mid = length / 2;
+    int q = mid * mid;
+
+    T       *C11 = C      , *C12 = C +   q;
+    T       *C21 = C + 2*q, *C22 = C + 3*q;
+    T const *A11 = A      , *A12 = A +   q;
+    T const *A21 = A + 2*q, *A22 = A + 3*q;
+    T const *B11 = B      , *B12 = B +   q;
+    T const *B21 = B + 2*q, *B22 = B + 3*q;
+
+    cilk_spawn mm_morton(C11, A11, B11, mid, block);
+    cilk_spawn mm_morton(C21, A21, B11, mid, block);
+    cilk_spawn mm_morton(C12, A11, B12, mid, block);
+    cilk_spawn mm_morton(C22, A21, B12, mid, block);
+    cilk_sync;
+    cilk_spawn mm_morton(C11, A12, B21, mid, block);
+    cilk_spawn mm_morton(C21, A22, B21, mid, block);
+    cilk_spawn mm_morton(C12, A12, B22, mid, block);
+    cilk_spawn mm_morton(C22, A22, B22, mid, block);
+    cilk_sync;
+}
+
+/* Tile size for the Morton layout: the largest power of 2 below
+ * mm_threshold, so the tiles are the leaves mm_internal would use. */
+inline int morton_block(int n)
+{
+    int block = 1;
+    while (block * 2 < mm_threshold && block * 2 <= n)
+        block *= 2;
+    return block;
+}
+
+/* mm_general is the recursive implementation of matrix multiply for
+ * matrices of any shape. */
+template <typename T>
+void mm_general (T *C, int ldc, const T *A, int lda, const T *B, int ldb,
+                 int m, int k, int n)
+/* Effect: Compute
+ *    C+=A*B,
+ * where C is an m-by-n, A an m-by-k and B a k-by-n submatrix.
+ * The rows of C, A, and B are ldc, lda, and ldb elements apart.
+ * The largest of the three dimensions is halved at each level, so the
+ * recursion stays cache oblivious for skinny and odd-sized matrices.
+ */
+{
+    static const long threshold = 16*16*16;
+    /* k-splits smaller than this run both halves serially rather than
+     * allocating a temporary */
+    static const long temp_threshold = 64*64*64;
+
+    if (m == 0 || k == 0 || n == 0)
+    {
+        return;
+    }
+    else if ((long)m*k*n <= threshold)
+    {
+        for (int i=0; i<m; i++)
+            for (int l=0; l<k; l++)
+                for (int j=0; j<n; j++)
+                    C[i*ldc+j] += A[i*lda+l] * B[l*ldb+j];
+    }
+    else if (m >= k && m >= n)
+    {
+        /* Split the rows of C and A */
+        int mid = m / 2;
+        cilk_spawn mm_general(C, ldc, A, lda, B, ldb, mid, k, n);
+        mm_general(C + mid*ldc, ldc, A + mid*lda, lda, B, ldb, m - mid, k, n);
+        cilk_sync;
+    }
+    else if (n >= k)
+    {
+        /* Split the columns of C and B */
+        int mid = n / 2;
+        cilk_spawn mm_general(C, ldc, A, lda, B, ldb, m, k, mid);
+        mm_general(C + mid, ldc, A, lda, B + mid, ldb, m, k, n - mid);
+        cilk_sync;
+    }
+    else
+    {
+        /* Split the columns of A and the rows of B.  Both halves update
+         * all of C, so the second one accumulates into a zeroed temporary
+         * that is added in once both are done, instead of waiting for the
+         * first half with a second sync. */
+        int mid = k / 2;
+        if ((long)m*k*n < temp_threshold)
+        {
+            mm_general(C, ldc, A, lda, B, ldb, m, mid, n);
+            mm_general(C, ldc, A + mid, lda, B + mid*ldb, ldb, m, k - mid, n);
+            return;
+        }
+        T *D = new T[m*n]();
+        cilk_spawn mm_general(C, ldc, A, lda, B, ldb, m, mid, n);
+        mm_general(D, n, A + mid, lda, B + mid*ldb, ldb, m, k - mid, n);
+        cilk_sync;
+        cilk_for (int i=0; i<m; i++)
+            for (int j=0; j<n; j++)
+                C[i*ldc+j] += D[i*n+j];
+        delete [] D;
+    }
+}
+
+/* return true iff n = 2^k. */
+inline bool is_power_of_2 (int n)
+{
+    bool match = false; /* whether a bit has been matched. */
+    int field = 0x1;    /* field for bit matching. */
+    for (int i = sizeof(int) * 8; i > 0; --i, field <<= 1)
+    {
+        if (field & n)
+        {
+            if (match) return false;
+            match = true;
+        }
+    }
+    return match;
+}
+
+/* This is the public interface to mm_internal. */
+template <typename T>
+void mm_recursive_parallel(T *C, const T *A, const T *B, int n)
+/* Effect:  C, A, and B are n*n matrices of Ts.
+ * Perform
+ *   C += A * B.
+ * mm_internal only handles powers of 2; other sizes go to mm_general.
+ */
+{
+    if (is_power_of_2(n))
+        mm_internal(C,A,B,n,n);
+    else
+        mm_general(C,n,A,n,B,n,n,n,n);
+}
+
+/* This is the public interface to mm_general. */
+template <typename T>
+void mm_recursive_general(T *C, const T *A, const T *B, int m, int k, int n)
+/* Effect:  C is an m*n, A an m*k and B a k*n matrix of Ts.
+ * Perform
+ *   C += A * B.
+ */
+{
+    mm_general(C,n,A,k,B,n,m,k,n);
+}
+
+#endif // MM_RECURSIVE_H
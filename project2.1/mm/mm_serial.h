@@ -0,0 +1,27 @@
+/* Copyright (C) 2006 Bradley C. Kuszmaul.
+ * Modified for Cilk++ by Pablo Halpern, May 2009
+ * This code is licensed under the Gnu General Public License (GPL).
+ */
+
+/* The reference matrix multiply shared by the mm programs.
+ * Matrices are laid out in row-major order. */
+
+#ifndef MM_SERIAL_H
+#define MM_SERIAL_H
+
+/* mm_loop_serial is the standard triply nested loop implementation.
+ *   C += A*B
+ * n is the matrix size.  Note that C is not set to zero -- its initial value
+ * is added to the matrix-product of B and C */
+template <typename T>
+void mm_loop_serial(T *C, const T *A, const T *B, int n)
+{
+    /* DO NOT MODIFY THIS CODE.  THIS IS USED TO VERIFY THAT YOUR
+     * CODE IS PRODUCING THE RIGHT ANSWER. */
+    for (int i=0; i<n; i++)
+        for (int j=0; j<n; j++)
+            for (int k=0; k<n; k++)
+                C[i*n+j] += A[i*n+k] * B[k*n+j];
+}
+
+#endif // MM_SERIAL_H
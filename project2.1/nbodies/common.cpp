@@ -8,18 +8,64 @@
 #include <iostream>
 #include <string>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <mm_malloc.h>
+#include <stdint.h>
+#include <stdexcept>
+#include <vector>
+#include <tbb/concurrent_queue.h>
+#include <tbb/tbb_thread.h>
 
 #include "common.h"
+#include <cilk/cilk.h>
+#include <cilk/reducer_opadd.h>
 
 /* Globals */
 
 Pixel bkgnd(240,240,240);       // default background color
 MTRand rnd;                     // random number generator object
+double opening_angle = OPENING_ANGLE;
+double time_step = TIME_QUANTUM;
+double softening2 = SOFTENING * SOFTENING;
+bool check_forces = false;
+bool integrator_moves_bodies = false;
+
+// Integrator main advances the bodies with
+enum Integrator { EULER, VERLET };
+static Integrator integrator = EULER;
+static int block_levels = 0;         // substep levels of the block scheme
+static int *body_level = NULL;       // level of each body this step
+static long long substep_forces = 0; // neighbour forces summed by block_step
+
+// Neighbours of the block scheme: the bodies within block_radius of body
+// i at the start of the step are nbr[nbr_start[i], nbr_start[i+1]).  The
+// force on body i is split into the force of its neighbours, near_xf[i],
+// near_yf[i], and of all the others, far_xf[i], far_yf[i].
+static double block_radius = 0.0;
+static std::vector<int> nbr_start, nbr;
+static std::vector<double> near_xf, near_yf, far_xf, far_yf;
+
+// Uniform grid of square cells of width cell from (x0, y0), nx by ny.
+// Body i is in cell cell_of[i], and the bodies of cell c are
+// index[start[c], start[c+1]).
+struct BodyGrid {
+    double x0, y0, cell;
+    int nx, ny;
+    std::vector<int> cell_of, start, index;
+};
+static BodyGrid grid;
+
+// Checkpoints: the bodies are saved to checkpoint_path every
+// checkpoint_every steps (never if 0)
+static long long checkpoint_every = 0;
+static const char *checkpoint_path = CHECKPOINT_FILE;
 
 /* Function Declarations */
 
-// These functions are implemented in the files nbodies_X.cilk, where
-// X is "loops", "symmetric", or "nolocks".
+// These functions are implemented in the files nbodies_X.cpp, where
+// X is "loops", "symmetric", "nolocks" or "soa".
 
 // Calculate forces between all of the bodies in the simulation for all pairs
 void calculate_forces(int nbodies, Body *bodies);
@@ -29,29 +75,14 @@ void update_positions(int nbodies, Body *bodies);
 
 /* Function Definitions */
 
-// Ensure that abs(r) >= THRESHOLD, preserving the sign. 
-// This avoids the singularity of gravitational forces for r=0
-static inline double make_nonzero(double r)
-{
-    const double THRESHOLD = 1.0e-100;
-    if (r > 0) {
-	if (r < THRESHOLD)
-	    r = THRESHOLD;
-    } else {
-	if (r > -THRESHOLD)
-	    r = -THRESHOLD;
-    }
-    return r;
-}
-
 // Calculate force between bodies bi and bj and return result in fx and fy
 void calculate_force(double *fx, double *fy, const Body &bi, const Body &bj)
 {
     double dx = make_nonzero(bj.x - bi.x);
     double dy = make_nonzero(bj.y - bi.y);
 
-    // compute distance between bodies
-    double dist2 = dx * dx + dy * dy;
+    // compute (softened) distance between bodies
+    double dist2 = dx * dx + dy * dy + softening2;
     double dist = std::sqrt( dist2 );
 
     // law of gravitation
@@ -71,6 +102,339 @@ void add_force(Body* b, double fx, double fy)
     b->mtx.unlock();
 }
 
+// Allocate the arrays of s for n bodies
+void soa_alloc(BodySoA *s, int n)
+{
+    s->n = n;
+    double **fields[] = { &s->x, &s->y, &s->xv, &s->yv, &s->xf, &s->yf,
+                          &s->mass };
+    for (int f = 0; f < 7; ++f) {
+        *fields[f] = (double *) _mm_malloc(n * sizeof(double), 64);
+        if (!*fields[f])
+            throw std::bad_alloc();
+    }
+}
+
+// Free the arrays of s
+void soa_free(BodySoA *s)
+{
+    double *fields[] = { s->x, s->y, s->xv, s->yv, s->xf, s->yf, s->mass };
+    for (int f = 0; f < 7; ++f)
+        _mm_free(fields[f]);
+    s->n = 0;
+}
+
+// Copy positions, velocities and masses of bodies into s and clear forces
+void soa_load(BodySoA *s, const Body *bodies)
+{
+    cilk_for (int i = 0; i < s->n; ++i) {
+        s->x[i] = bodies[i].x;
+        s->y[i] = bodies[i].y;
+        s->xv[i] = bodies[i].xv;
+        s->yv[i] = bodies[i].yv;
+        s->xf[i] = 0.0;
+        s->yf[i] = 0.0;
+        s->mass[i] = bodies[i].mass;
+    }
+}
+
+// Compare the forces accumulated in bodies against exact pairwise forces
+// for FORCE_SAMPLES evenly spaced bodies, print the relative error and
+// return the largest one
+double report_force_error(int nbodies, const Body *bodies)
+{
+    int nsamples = std::min(nbodies, FORCE_SAMPLES);
+    double max_err = 0.0, sum_err2 = 0.0;
+    for (int s = 0; s < nsamples; ++s) {
+        int i = int((long long) s * nbodies / nsamples);
+        double ex = 0.0, ey = 0.0;
+        for (int j = 0; j < nbodies; ++j) {
+            if (i == j) continue;
+            double fx, fy;
+            calculate_force(&fx, &fy, bodies[i], bodies[j]);
+            ex += fx;
+            ey += fy;
+        }
+        double dx = bodies[i].xf - ex, dy = bodies[i].yf - ey;
+        double norm = std::sqrt(ex * ex + ey * ey);
+        double err = norm > 0 ? std::sqrt(dx * dx + dy * dy) / norm : 0.0;
+        max_err = std::max(max_err, err);
+        sum_err2 += err * err;
+    }
+    std::cout << "force error over " << nsamples << " bodies: max "
+              << max_err << " rms " << std::sqrt(sum_err2 / nsamples)
+              << std::endl;
+    return max_err;
+}
+
+// Total kinetic plus gravitational potential energy of the bodies
+static double total_energy(int nbodies, const Body *bodies)
+{
+    cilk::reducer_opadd<double> kinetic, potential;
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        const Body &b = bodies[i];
+        kinetic += 0.5 * b.mass * (b.xv * b.xv + b.yv * b.yv);
+        double u = 0.0;
+        for (int j = 0; j < i; ++j) {
+            double dx = make_nonzero(bodies[j].x - b.x);
+            double dy = make_nonzero(bodies[j].y - b.y);
+            u -= GRAVITY * b.mass * bodies[j].mass
+                 / std::sqrt(dx * dx + dy * dy + softening2);
+        }
+        potential += u;
+    }
+    return kinetic.get_value() + potential.get_value();
+}
+
+// Clear the forces and recompute them with the variant's solver
+static void verlet_forces(int nbodies, Body *bodies)
+{
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        bodies[i].xf = 0.0;
+        bodies[i].yf = 0.0;
+    }
+    calculate_forces(nbodies, bodies);
+}
+
+// Bin the bodies into grid, with cells at least block_radius wide so the
+// bodies within block_radius of a body are in its cell or the 8 around
+// it.  block_radius holds about BLOCK_NEIGHBOURS bodies at the mean
+// density, and is at least 4 vmax time_step: no two bodies close by more
+// than half of it within a step, so a body outside it at the start of
+// the step can't become a close encounter before the step ends.
+static void bin_bodies(int nbodies, const Body *bodies)
+{
+    double x0 = bodies[0].x, x1 = x0, y0 = bodies[0].y, y1 = y0;
+    double v2max = 0.0;
+    for (int i = 0; i < nbodies; ++i) {
+        const Body &b = bodies[i];
+        x0 = std::min(x0, b.x);
+        x1 = std::max(x1, b.x);
+        y0 = std::min(y0, b.y);
+        y1 = std::max(y1, b.y);
+        v2max = std::max(v2max, b.xv * b.xv + b.yv * b.yv);
+    }
+    const double w = std::max(x1 - x0, 1.0), h = std::max(y1 - y0, 1.0);
+    block_radius = std::max(std::sqrt(w * h * BLOCK_NEIGHBOURS
+                                      / (M_PI * nbodies)),
+                            4.0 * std::sqrt(v2max) * time_step);
+    // far outliers stretch the box; keep to about 4 bodies a cell
+    grid.cell = std::max(block_radius, std::sqrt(w * h / (4.0 * nbodies)));
+    grid.x0 = x0;
+    grid.y0 = y0;
+    grid.nx = int(w / grid.cell) + 1;
+    grid.ny = int(h / grid.cell) + 1;
+
+    // counting sort of the bodies by cell
+    grid.start.assign(grid.nx * grid.ny + 1, 0);
+    grid.cell_of.resize(nbodies);
+    grid.index.resize(nbodies);
+    for (int i = 0; i < nbodies; ++i) {
+        int cx = int((bodies[i].x - x0) / grid.cell);
+        int cy = int((bodies[i].y - y0) / grid.cell);
+        grid.cell_of[i] = cy * grid.nx + cx;
+        ++grid.start[grid.cell_of[i] + 1];
+    }
+    for (int c = 0; c < grid.nx * grid.ny; ++c)
+        grid.start[c + 1] += grid.start[c];
+    std::vector<int> fill(grid.start.begin(), grid.start.end() - 1);
+    for (int i = 0; i < nbodies; ++i)
+        grid.index[fill[grid.cell_of[i]]++] = i;
+}
+
+// Store in out the bodies other than i within block_radius of it, unless
+// out is NULL, and return how many there are
+static int find_neighbours(const Body *bodies, int i, int *out)
+{
+    const double r2 = block_radius * block_radius;
+    const int cx = grid.cell_of[i] % grid.nx, cy = grid.cell_of[i] / grid.nx;
+    int count = 0;
+    for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, grid.ny - 1); ++y)
+        for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, grid.nx - 1);
+             ++x) {
+            const int c = y * grid.nx + x;
+            for (int k = grid.start[c]; k < grid.start[c + 1]; ++k) {
+                const int j = grid.index[k];
+                double dx = bodies[j].x - bodies[i].x;
+                double dy = bodies[j].y - bodies[i].y;
+                if (j == i || dx * dx + dy * dy >= r2)
+                    continue;
+                if (out)
+                    out[count] = j;
+                ++count;
+            }
+        }
+    return count;
+}
+
+// Sum into (*fx, *fy) the forces on body i from its neighbours
+static void neighbour_force(double *fx, double *fy, const Body *bodies, int i)
+{
+    double sx = 0.0, sy = 0.0;
+    for (int k = nbr_start[i]; k < nbr_start[i + 1]; ++k) {
+        double f1, f2;
+        calculate_force(&f1, &f2, bodies[i], bodies[nbr[k]]);
+        sx += f1;
+        sy += f2;
+    }
+    *fx = sx;
+    *fy = sy;
+}
+
+/* Set up the block scheme for a step, from the forces in bodies at the
+ * start of it.  Find each body's neighbours, split its force into the
+ * part from them, near_xf/near_yf, and the rest, far_xf/far_yf, and pick
+ * its level from the shortest time scale of its neighbour pairs: the
+ * time to close their distance at their relative speed, or their
+ * free-fall time if that is shorter.  A body goes down levels until its
+ * step is within BLOCK_ETA of that time.  The time scale of a pair is the
+ * same for both bodies, so both of a pair nearing an encounter are put
+ * on the finer level before it happens; pairs outside block_radius can't
+ * meet within the step. */
+static void assign_levels(int nbodies, const Body *bodies)
+{
+    bin_bodies(nbodies, bodies);
+    nbr_start.resize(nbodies + 1);
+    nbr_start[0] = 0;
+    cilk_for (int i = 0; i < nbodies; ++i)
+        nbr_start[i + 1] = find_neighbours(bodies, i, NULL);
+    for (int i = 0; i < nbodies; ++i)
+        nbr_start[i + 1] += nbr_start[i];
+    nbr.resize(std::max(nbr_start[nbodies], 1));
+    near_xf.resize(nbodies);
+    near_yf.resize(nbodies);
+    far_xf.resize(nbodies);
+    far_yf.resize(nbodies);
+
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        const Body &b = bodies[i];
+        find_neighbours(bodies, i, &nbr[nbr_start[i]]);
+        neighbour_force(&near_xf[i], &near_yf[i], bodies, i);
+        far_xf[i] = b.xf - near_xf[i];
+        far_yf[i] = b.yf - near_yf[i];
+
+        double t2 = time_step * time_step / (BLOCK_ETA * BLOCK_ETA);
+        for (int k = nbr_start[i]; k < nbr_start[i + 1]; ++k) {
+            const Body &o = bodies[nbr[k]];
+            double dx = o.x - b.x, dy = o.y - b.y;
+            double dvx = o.xv - b.xv, dvy = o.yv - b.yv;
+            double r2 = dx * dx + dy * dy + softening2;
+            double v2 = dvx * dvx + dvy * dvy;
+            // squared crossing and free-fall times
+            double cross2 = v2 > 0 ? r2 / v2 : t2;
+            double fall2 = r2 * std::sqrt(r2)
+                           / (GRAVITY * (b.mass + o.mass));
+            t2 = std::min(t2, std::min(cross2, fall2));
+        }
+        double s = time_step * time_step / (BLOCK_ETA * BLOCK_ETA * t2);
+        int k = 0;
+        while (s > 1.0 && k < block_levels) {
+            s /= 4.0;
+            ++k;
+        }
+        body_level[i] = k;
+    }
+}
+
+/* Advance the bodies one time_step with kick-drift-kick leapfrog
+ * (velocity Verlet).  The forces in bodies must be those at the current
+ * positions; they are left at the new positions for the next step. */
+static void verlet_step(int nbodies, Body *bodies)
+{
+    const double half = 0.5 * time_step;
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        Body &b = bodies[i];
+        b.xv += half * b.xf / b.mass;
+        b.yv += half * b.yf / b.mass;
+        b.x += time_step * b.xv;
+        b.y += time_step * b.yv;
+    }
+    verlet_forces(nbodies, bodies);
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        Body &b = bodies[i];
+        b.xv += half * b.xf / b.mass;
+        b.yv += half * b.yf / b.mass;
+    }
+}
+
+/* Advance the bodies one time_step like verlet_step, but with block
+ * timesteps for the forces between neighbours.  The far force of every
+ * body kicks it at the two ends of the step only.  In between, a body on
+ * level k takes 2^k kick-drift-kick steps of time_step / 2^k with the
+ * force of its neighbours at the current positions, and all bodies drift
+ * on the finest substep.  Both levels of the split are symmetric in
+ * time, and a body on level 0 moves exactly as in verlet_step.  The
+ * variant's calculate_forces gives the forces at the end of the step,
+ * from which the neighbour forces are subtracted for the far kick. */
+static void block_step(int nbodies, Body *bodies)
+{
+    const int nsub = 1 << block_levels;
+    const double h = time_step / nsub;
+    const double half = 0.5 * time_step;
+    assign_levels(nbodies, bodies);
+
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        bodies[i].xv += half * far_xf[i] / bodies[i].mass;
+        bodies[i].yv += half * far_yf[i] / bodies[i].mass;
+    }
+    for (int s = 0; s < nsub; ++s) {
+        const bool last = (s + 1 == nsub);
+        // first half kick for the bodies whose step begins here, then drift
+        cilk_for (int i = 0; i < nbodies; ++i) {
+            Body &b = bodies[i];
+            const int k = body_level[i];
+            if (s % (nsub >> k) == 0) {
+                const double half_k = half / (1 << k);
+                b.xv += half_k * near_xf[i] / b.mass;
+                b.yv += half_k * near_yf[i] / b.mass;
+            }
+            b.x += h * b.xv;
+            b.y += h * b.yv;
+        }
+
+        if (last)
+            verlet_forces(nbodies, bodies);
+        // neighbour forces of the bodies whose step ends here
+        cilk::reducer_opadd<long long> summed;
+        cilk_for (int i = 0; i < nbodies; ++i) {
+            if ((s + 1) % (nsub >> body_level[i]) != 0)
+                continue;
+            neighbour_force(&near_xf[i], &near_yf[i], bodies, i);
+            summed += nbr_start[i + 1] - nbr_start[i];
+        }
+        substep_forces += summed.get_value();
+
+        // second half kick for the bodies whose step ends here
+        cilk_for (int i = 0; i < nbodies; ++i) {
+            Body &b = bodies[i];
+            const int k = body_level[i];
+            if ((s + 1) % (nsub >> k) == 0) {
+                const double half_k = half / (1 << k);
+                b.xv += half_k * near_xf[i] / b.mass;
+                b.yv += half_k * near_yf[i] / b.mass;
+            }
+        }
+    }
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        Body &b = bodies[i];
+        b.xv += half * (b.xf - near_xf[i]) / b.mass;
+        b.yv += half * (b.yf - near_yf[i]) / b.mass;
+    }
+}
+
+// Advance the bodies one step with the selected integrator
+static void advance(int nbodies, Body *bodies)
+{
+    if (integrator == VERLET && block_levels > 0) {
+        block_step(nbodies, bodies);
+    } else if (integrator == VERLET) {
+        verlet_step(nbodies, bodies);
+    } else {
+        calculate_forces(nbodies, bodies);
+        update_positions(nbodies, bodies);
+    }
+}
+
 // For debugging
 void dumpbody(Body &b)
 {
@@ -246,79 +610,506 @@ void initialize_bodies(int nbodies, Body *bodies, int maxx, int maxy)
 
 }
 
-int main(int argc, char* argv[])
+// Renders and writes stepN.png frames.  With a queue depth of zero each
+// frame is drawn and encoded on the calling thread; otherwise write()
+// copies the bodies into one of depth snapshot buffers and hands it to a
+// background thread, so the simulation only waits when all of the
+// buffers are still queued for encoding.
+class ImageWriter {
+public:
+    ImageWriter(int nbodies, int depth);
+    ~ImageWriter();
+
+    // Draw bodies as frame cnt, blocking only while the queue is full
+    void write(int cnt, const Body *bodies);
+
+    // Wait for all queued frames to be written; rethrows encoder errors
+    void finish();
+
+private:
+    struct Frame {
+        int index;      // frame number, -1 to stop the writer thread
+        Body *bodies;   // snapshot buffer
+    };
+
+    static void run(ImageWriter *w);
+    void stop();
+    void render(const Frame &frame);
+
+    int nbodies;
+    int depth;
+    Image image;
+    Body *buffers;
+    tbb::concurrent_bounded_queue<Frame> pending;   // frames to encode
+    tbb::concurrent_bounded_queue<Body*> spare;     // reusable snapshots
+    tbb::tbb_thread *thread;
+    std::string error;
+};
+
+ImageWriter::ImageWriter(int nbodies, int depth)
+    : nbodies(nbodies), depth(depth), image(MAXW, MAXH),
+      buffers(NULL), thread(NULL)
+{
+    if (depth == 0)
+        return;
+    buffers = new Body[depth * nbodies];
+    for (int d = 0; d < depth; ++d)
+        spare.push(buffers + d * nbodies);
+    thread = new tbb::tbb_thread(run, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+    stop();
+    delete[] buffers;
+}
+
+void ImageWriter::write(int cnt, const Body *bodies)
+{
+    if (depth == 0) {
+        // draw straight from the live bodies
+        update_picture(MAXW, MAXH, nbodies, const_cast<Body*>(bodies),
+                       bkgnd, image);
+        char fname[50];
+        std::sprintf(fname, "step%d.png", cnt);
+        image.write(fname);
+        return;
+    }
+
+    Frame frame = { cnt, NULL };
+    spare.pop(frame.bodies);
+    // copy only what update_picture reads
+    for (int i = 0; i < nbodies; ++i) {
+        frame.bodies[i].x = bodies[i].x;
+        frame.bodies[i].y = bodies[i].y;
+        frame.bodies[i].mass = bodies[i].mass;
+        frame.bodies[i].density = bodies[i].density;
+        frame.bodies[i].color = bodies[i].color;
+    }
+    pending.push(frame);
+}
+
+void ImageWriter::finish()
+{
+    stop();
+    if (!error.empty())
+        throw std::runtime_error(error);
+}
+
+// Let the writer thread drain the queue and exit
+void ImageWriter::stop()
+{
+    if (thread) {
+        Frame last = { -1, NULL };
+        pending.push(last);
+        thread->join();
+        delete thread;
+        thread = NULL;
+    }
+}
+
+void ImageWriter::run(ImageWriter *w)
+{
+    Frame frame;
+    for (;;) {
+        w->pending.pop(frame);
+        if (frame.index < 0)
+            return;
+        // after a failure keep draining so write() never blocks forever
+        if (w->error.empty())
+            w->render(frame);
+        w->spare.push(frame.bodies);
+    }
+}
+
+void ImageWriter::render(const Frame &frame)
 try
 {
-    int nbodies = NBODIES;       // default
-    if (argc > 1) {
-        nbodies = atoi(argv[1]);
-        if (nbodies <= 0 || nbodies > 20000) {
-            std::cerr << "Usage: nbodies [nbodies] [nimages] "
-                      << "where 0 < nbodies < 20001"
-                      << std::endl;
-            return 1;
-        }
+    update_picture(MAXW, MAXH, nbodies, frame.bodies, bkgnd, image);
+    char fname[50];
+    std::sprintf(fname, "step%d.png", frame.index);
+    image.write(fname);
+}
+catch (std::exception const& e)
+{
+    error = e.what();
+}
+
+/* Checkpoint file layout, native byte order:
+ *   char[8]  CHECKPOINT_MAGIC
+ *   int32    number of bodies
+ *   int64    steps simulated so far
+ * then per body
+ *   double   x, y, xv, yv, mass, density
+ *   uint8    red, green, blue, alpha
+ * Forces are not saved: they are zero between Euler steps, and the
+ * leapfrog recomputes them from the positions when it starts. */
+static const char CHECKPOINT_MAGIC[8] = { 'N','B','O','D','Y','C','K','1' };
+static const size_t CHECKPOINT_RECORD = 6 * sizeof(double) + 4;
+
+// Write the bodies after step steps to path.  The file is written under
+// a temporary name and renamed, so a crash never leaves a torn snapshot.
+static void write_checkpoint(const char *path, long long step,
+                             int nbodies, const Body *bodies)
+{
+    std::string tmp = std::string(path) + ".tmp";
+    FILE *f = std::fopen(tmp.c_str(), "wb");
+    if (!f)
+        throw std::runtime_error("cannot create checkpoint " + tmp);
+
+    int32_t n = nbodies;
+    int64_t s = step;
+    bool ok = std::fwrite(CHECKPOINT_MAGIC, sizeof CHECKPOINT_MAGIC, 1, f) == 1
+           && std::fwrite(&n, sizeof n, 1, f) == 1
+           && std::fwrite(&s, sizeof s, 1, f) == 1;
+    unsigned char record[CHECKPOINT_RECORD];
+    for (int i = 0; ok && i < nbodies; ++i) {
+        const Body &b = bodies[i];
+        const double fields[6] = { b.x, b.y, b.xv, b.yv, b.mass, b.density };
+        std::memcpy(record, fields, sizeof fields);
+        unsigned char *c = record + sizeof fields;
+        c[0] = b.color.red;
+        c[1] = b.color.green;
+        c[2] = b.color.blue;
+        c[3] = b.color.alpha;
+        ok = std::fwrite(record, sizeof record, 1, f) == 1;
+    }
+    if (std::fclose(f) != 0 || !ok)
+        throw std::runtime_error("cannot write checkpoint " + tmp);
+    if (std::rename(tmp.c_str(), path) != 0)
+        throw std::runtime_error("cannot rename checkpoint to "
+                                 + std::string(path));
+}
+
+// Read a checkpoint written by write_checkpoint into a new array stored in
+// *bodies and return the number of steps it was taken after
+static long long read_checkpoint(const char *path, int *nbodies,
+                                 Body **bodies)
+{
+    FILE *f = std::fopen(path, "rb");
+    if (!f)
+        throw std::runtime_error("cannot open checkpoint "
+                                 + std::string(path));
+
+    char magic[sizeof CHECKPOINT_MAGIC];
+    int32_t n = 0;
+    int64_t s = 0;
+    bool ok = std::fread(magic, sizeof magic, 1, f) == 1
+           && std::memcmp(magic, CHECKPOINT_MAGIC, sizeof magic) == 0
+           && std::fread(&n, sizeof n, 1, f) == 1
+           && std::fread(&s, sizeof s, 1, f) == 1
+           && n > 0 && n <= max_nbodies && s >= 0;
+    if (!ok) {
+        std::fclose(f);
+        throw std::runtime_error(std::string(path)
+                                 + " is not a checkpoint for this solver");
+    }
+
+    Body *b = new Body[n];
+    unsigned char record[CHECKPOINT_RECORD];
+    for (int i = 0; ok && i < n; ++i) {
+        ok = std::fread(record, sizeof record, 1, f) == 1;
+        double fields[6];
+        std::memcpy(fields, record, sizeof fields);
+        const unsigned char *c = record + sizeof fields;
+        b[i].x = fields[0];
+        b[i].y = fields[1];
+        b[i].xv = fields[2];
+        b[i].yv = fields[3];
+        b[i].mass = fields[4];
+        b[i].density = fields[5];
+        b[i].xf = 0.0;
+        b[i].yf = 0.0;
+        b[i].color = Pixel(c[0], c[1], c[2], c[3]);
+    }
+    std::fclose(f);
+    if (!ok) {
+        delete[] b;
+        throw std::runtime_error("checkpoint " + std::string(path)
+                                 + " is truncated");
+    }
+    *nbodies = n;
+    *bodies = b;
+    return s;
+}
+
+// Advance one step and count it in *step, checkpointing when due
+static void advance_step(int nbodies, Body *bodies, long long *step)
+{
+    advance(nbodies, bodies);
+    ++*step;
+    if (checkpoint_every > 0 && *step % checkpoint_every == 0)
+        write_checkpoint(checkpoint_path, *step, nbodies, bodies);
+}
+
+// Sum of the body positions, accumulated serially so the value depends
+// only on the positions and not on the worker count.
+static double position_checksum(int nbodies, const Body *bodies)
+{
+    double sum = 0.0;
+    for (int i = 0; i < nbodies; ++i)
+        sum += bodies[i].x + bodies[i].y;
+    return sum;
+}
+
+// Print the optional end of run reports: the relative energy drift since
+// initial_energy, how much of the work went to block substeps, and the
+// position checksum
+static void report_run(int nbodies, const Body *bodies, long long nsteps,
+                       double initial_energy, bool energy, bool checksum)
+{
+    if (energy) {
+        double e = total_energy(nbodies, bodies);
+        std::printf("energy: initial %.10g final %.10g drift %.3g\n",
+                    initial_energy, e,
+                    std::fabs((e - initial_energy) / initial_energy));
+    }
+    if (block_levels > 0 && nsteps > 0) {
+        std::printf("block substeps: %lld neighbour forces, %.3g per "
+                    "body per step\n", substep_forces,
+                    double(substep_forces) / nbodies / nsteps);
     }
+    if (checksum)
+        std::printf("checksum: %.17g\n", position_checksum(nbodies, bodies));
+}
 
+int main(int argc, char* argv[])
+try
+{
+    int nbodies = NBODIES;       // default
     int nimages = NIMAGES;       // default
-    if (argc > 2) {
-        nimages = atoi(argv[2]);
-        if (nimages <= 0 || nimages > 2000) {
-            std::cerr << "Usage: nbodies [nbodies] [nimages] "
-                      << "where 0 < nimages <= 2000"
-                      << std::endl;
+    int positional = 0;
+    bool bench = false;          // skip all image output
+    bool checksum = false;
+    int queue_depth = IMAGE_QUEUE;
+    bool energy = false;
+    const char *resume = NULL;
+    for (int a = 1; a < argc; ++a) {
+        const char *arg = argv[a];
+        if (std::strncmp(arg, "--theta=", 8) == 0) {
+            opening_angle = atof(arg + 8);
+            if (opening_angle <= 0) {
+                std::cerr << "nbodies: --theta must be positive"
+                          << std::endl;
+                return 1;
+            }
+        } else if (std::strncmp(arg, "--softening=", 12) == 0) {
+            double eps = atof(arg + 12);
+            if (eps < 0) {
+                std::cerr << "nbodies: --softening must not be negative"
+                          << std::endl;
+                return 1;
+            }
+            softening2 = eps * eps;
+        } else if (std::strcmp(arg, "--check-forces") == 0) {
+            check_forces = true;
+        } else if (std::strcmp(arg, "--bench") == 0 ||
+                   std::strcmp(arg, "--no-images") == 0) {
+            bench = true;
+        } else if (std::strcmp(arg, "--checksum") == 0) {
+            checksum = true;
+        } else if (std::strncmp(arg, "--queue=", 8) == 0) {
+            queue_depth = atoi(arg + 8);
+            if (queue_depth < 0) {
+                std::cerr << "nbodies: --queue must not be negative"
+                          << std::endl;
+                return 1;
+            }
+        } else if (std::strncmp(arg, "--integrator=", 13) == 0) {
+            const char *name = arg + 13;
+            if (std::strcmp(name, "euler") == 0) {
+                integrator = EULER;
+            } else if (std::strcmp(name, "verlet") == 0 ||
+                       std::strcmp(name, "leapfrog") == 0) {
+                integrator = VERLET;
+            } else {
+                std::cerr << "nbodies: unknown integrator " << name
+                          << std::endl;
+                return 1;
+            }
+        } else if (std::strncmp(arg, "--dt=", 5) == 0) {
+            time_step = atof(arg + 5);
+            if (!(time_step > 0)) {
+                std::cerr << "nbodies: --dt must be positive" << std::endl;
+                return 1;
+            }
+        } else if (std::strncmp(arg, "--block=", 8) == 0) {
+            block_levels = atoi(arg + 8);
+            if (block_levels < 0 || block_levels > MAX_BLOCK_LEVELS) {
+                std::cerr << "nbodies: --block must be in [0, "
+                          << MAX_BLOCK_LEVELS << "]" << std::endl;
+                return 1;
+            }
+        } else if (std::strcmp(arg, "--energy") == 0) {
+            energy = true;
+        } else if (std::strncmp(arg, "--checkpoint=", 13) == 0) {
+            checkpoint_every = atoll(arg + 13);
+            if (checkpoint_every < 0) {
+                std::cerr << "nbodies: --checkpoint must not be negative"
+                          << std::endl;
+                return 1;
+            }
+        } else if (std::strncmp(arg, "--checkpoint-file=", 18) == 0) {
+            checkpoint_path = arg + 18;
+        } else if (std::strcmp(arg, "--resume") == 0) {
+            resume = checkpoint_path;
+        } else if (std::strncmp(arg, "--resume=", 9) == 0) {
+            resume = arg + 9;
+        } else if (positional == 0) {
+            nbodies = atoi(arg);
+            ++positional;
+            if (nbodies <= 0 || nbodies > max_nbodies) {
+                std::cerr << "Usage: nbodies [options] [nbodies] [nimages] "
+                          << "where 0 < nbodies <= " << max_nbodies
+                          << std::endl;
+                return 1;
+            }
+        } else if (positional == 1) {
+            nimages = atoi(arg);
+            ++positional;
+            if (nimages <= 0 || nimages > 2000) {
+                std::cerr << "Usage: nbodies [options] [nbodies] [nimages] "
+                          << "where 0 < nimages <= 2000"
+                          << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: nbodies [options] [nbodies] [nimages]"
+                      << std::endl
+                      << "  --theta=T        Barnes-Hut opening angle "
+                      << "(default " << OPENING_ANGLE << ")" << std::endl
+                      << "  --softening=EPS  Plummer softening length "
+                      << "of the force law (default " << SOFTENING << ")"
+                      << std::endl
+                      << "  --check-forces   report the error of "
+                      << "approximate force solvers" << std::endl
+                      << "  --bench, --no-images" << std::endl
+                      << "                   only simulate; report "
+                      << "steps/s and interactions/s" << std::endl
+                      << "  --checksum       print a checksum of the "
+                      << "final positions" << std::endl
+                      << "  --queue=D        frames buffered for the "
+                      << "background PNG writer, 0 to write inline "
+                      << "(default " << IMAGE_QUEUE << ")" << std::endl
+                      << "  --integrator=I   euler (default) or verlet "
+                      << "(leapfrog)" << std::endl
+                      << "  --dt=DT          integration time step "
+                      << "(default " << TIME_QUANTUM << ")" << std::endl
+                      << "  --block=K        verlet with block timesteps "
+                      << "down to DT/2^K" << std::endl
+                      << "  --energy         report the energy drift "
+                      << "of the run" << std::endl
+                      << "  --checkpoint=K   save the bodies every K "
+                      << "steps" << std::endl
+                      << "  --checkpoint-file=F" << std::endl
+                      << "                   checkpoint file (default "
+                      << CHECKPOINT_FILE << ")" << std::endl
+                      << "  --resume[=F]     continue the run saved in "
+                      << "a checkpoint" << std::endl;
             return 1;
         }
     }
+    if (block_levels > 0 && integrator == EULER) {
+        // block timesteps are only implemented for the leapfrog
+        integrator = VERLET;
+    }
+    integrator_moves_bodies = (integrator == VERLET);
 
 #ifdef SEED1
     // seed random number generator with 1
     rnd.seed(1);
 #endif
 
-    Image newimage(MAXW, MAXH);
-
     // define a force between pixels as if the value of each color (RGB) was a
     // "color-mass" that interacted as a gravitational force that interacts
     // with the "color-mass" of other pixels.
 
-    Body *bodies = new Body[nbodies];
+    Body *bodies = NULL;
+    long long step = 0;          // steps simulated so far
+    if (resume) {
+        int saved;
+        step = read_checkpoint(resume, &saved, &bodies);
+        if (positional > 0 && saved != nbodies) {
+            std::cerr << "nbodies: " << resume << " holds " << saved
+                      << " bodies, not " << nbodies << std::endl;
+            delete[] bodies;
+            return 1;
+        }
+        nbodies = saved;
+        std::cout << "resumed " << nbodies << " bodies at step " << step
+                  << std::endl;
+    } else {
+        bodies = new Body[nbodies];
+        initialize_bodies(nbodies, bodies, MAXW * SCALE, MAXH * SCALE);
+    }
+    // the run ends after the same number of steps whether or not it was
+    // resumed
+    const long long last_step = (long long)(nimages - 1) * NSTEPS;
+    const double initial_energy = energy ? total_energy(nbodies, bodies) : 0;
+    if (integrator == VERLET) {
+        // leapfrog starts from the forces at the initial positions
+        if (block_levels > 0)
+            body_level = new int[nbodies];
+        verlet_forces(nbodies, bodies);
+    }
+
+    if (bench) {
+        const long long nsteps = std::max(last_step - step, 0LL);
+        cilkview_data_t start, end;
+        __cilkview_query(start);
+        while (step < last_step)
+            advance_step(nbodies, bodies, &step);
+        __cilkview_query(end);
+        const long long ms = end.time - start.time;
+        // direct-sum equivalent: every unordered pair once per step
+        const double pairs = 0.5 * nbodies * (nbodies - 1.0) * nsteps;
+        const double secs = (ms > 0 ? ms : 1) / 1000.0;
+        std::cout << "nbodies time: " << ms << "ms" << std::endl;
+        std::cout << "steps: " << nsteps
+                  << "  steps/s: " << nsteps / secs
+                  << "  interactions/s: " << pairs / secs << std::endl;
+        report_run(nbodies, bodies, nsteps, initial_energy, energy, checksum);
+        delete[] body_level;
+        delete[] bodies;
+        std::cout << "done." << std::endl;
+        return 0;
+    }
 
-    initialize_bodies(nbodies, bodies, MAXW * SCALE, MAXH * SCALE);
-    update_picture(MAXW, MAXH, nbodies, bodies, bkgnd, newimage);
-    newimage.write("step0.png");
+    ImageWriter writer(nbodies, queue_depth);
+    if (step == 0)
+        writer.write(0, bodies);
 
     cilkview_data_t start, end;
     long long int total_time = 0;
-    for (int cnt = 1; cnt< nimages; ++cnt)
+    const long long first_step = step;
+    for (int cnt = int(step / NSTEPS) + 1; cnt< nimages; ++cnt)
     {
       //TODO we want to only profile the time actually calculating
       //not the image writing time, unsure of how to accumulate the resultsi
       //If multiple reports are written with the same tag, Cilk view will plot the smallest one
       //for this it is unclear  if it might be a problem
         __cilkview_query(start);
-        for (int i=0; i<NSTEPS; ++i)    {
-            calculate_forces(nbodies, bodies);
-            update_positions(nbodies, bodies);
+        while (step < (long long)cnt * NSTEPS)    {
+            advance_step(nbodies, bodies, &step);
 #ifdef DEBUG
             dumpbodies(nbodies, bodies);
 #endif
         }
         __cilkview_query(end);
         total_time += (end.time - start.time);
-        update_picture(MAXW, MAXH, nbodies, bodies, bkgnd, newimage);
-
-        char fname[50];
-        std::sprintf(fname, "step%d.png", cnt);
-        newimage.write(fname);
+        writer.write(cnt, bodies);
     }
+    writer.finish();
     std::cout << "nbodies time: " << total_time << "ms" << std::endl;
+    report_run(nbodies, bodies, std::max(last_step - first_step, 0LL),
+               initial_energy, energy, checksum);
     __cilkview_do_report(&start, &end, "nbodies", CV_REPORT_WRITE_TO_LOG | CV_REPORT_WRITE_TO_RESULTS);
 
 
     
     
     
+    delete[] body_level;
     delete[] bodies;
 
     std::cout << "done." << std::endl;
@@ -33,8 +33,17 @@ extern "C++" {
 #define NIMAGES 100          // default number of images to generate
 #define NSTEPS 40            // number of simulation steps between images
 #define SCALE 12             // universe = MAXW * SCALE, MAXX * SCALE
-#define TIME_QUANTUM 0.2     // integration time step
+#define TIME_QUANTUM 0.2     // default integration time step
 #define GRAVITY 0.2          // gravitational constant
+#define OPENING_ANGLE 0.5    // default Barnes-Hut opening angle theta
+#define SOFTENING 0.0        // default Plummer softening length (point masses)
+#define FORCE_SAMPLES 1000   // bodies sampled when checking forces
+#define FORCE_TOLERANCE 1e-10 // relative error allowed of exact solvers
+#define IMAGE_QUEUE 2        // default frames queued for the PNG writer
+#define BLOCK_ETA 0.01       // block timestep accuracy, fraction of pair time scale
+#define MAX_BLOCK_LEVELS 8   // finest block step is time_step / 2^8
+#define BLOCK_NEIGHBOURS 16  // bodies within the block neighbour radius
+#define CHECKPOINT_FILE "nbodies.ckpt" // default checkpoint file
 
 #define SEED1                // seed random number generator with 1
 
@@ -57,10 +66,79 @@ struct Body {
     tbb::mutex mtx; //mutex lock
 };
 
+// Structure-of-arrays copy of the body state: one 64-byte aligned array
+// per field, so force kernels get unit-stride, vectorizable access and no
+// per-body lock.
+struct BodySoA {
+    int n;          // number of bodies
+    double *x;      // x positions
+    double *y;      // y positions
+    double *xv;     // x velocities
+    double *yv;     // y velocities
+    double *xf;     // x forces
+    double *yf;     // y forces
+    double *mass;   // masses
+};
+
+/* Globals */
+
+// Largest number of bodies the force solver handles; defined by each of
+// the nbodies_X.cpp files
+extern const int max_nbodies;
+
+// Opening angle of the Barnes-Hut solver, set with --theta
+extern double opening_angle;
+
+// Integration time step, set with --dt
+extern double time_step;
+
+// Square of the Plummer softening length added to every squared
+// distance in the force law, set with --softening
+extern double softening2;
+
+// Whether approximate solvers report their error against the exact
+// forces, set with --check-forces
+extern bool check_forces;
+
+// Whether the integrator advances the bodies in common.cpp rather than
+// with update_positions (velocity Verlet), so a variant keeping its own
+// copy of the bodies must reload it in calculate_forces and leave the
+// forces in bodies
+extern bool integrator_moves_bodies;
+
 /* Function Declarations */
 
+// Ensure that abs(r) >= THRESHOLD, preserving the sign. 
+// This avoids the singularity of gravitational forces for r=0
+static inline double make_nonzero(double r)
+{
+    const double THRESHOLD = 1.0e-100;
+    if (r > 0) {
+	if (r < THRESHOLD)
+	    r = THRESHOLD;
+    } else {
+	if (r > -THRESHOLD)
+	    r = -THRESHOLD;
+    }
+    return r;
+}
+
 /* Calculate force between bodies bi and bj and return result in fx and fy */
 void calculate_force(double *fx, double *fy, const Body &bi, const Body &bj);
 
 // Add force, (fx,fy) to body b
 void add_force(Body* b, double fx, double fy);
+
+// Allocate the arrays of s for n bodies
+void soa_alloc(BodySoA *s, int n);
+
+// Free the arrays of s
+void soa_free(BodySoA *s);
+
+// Copy positions, velocities and masses of bodies into s and clear forces
+void soa_load(BodySoA *s, const Body *bodies);
+
+// Compare the forces accumulated in bodies against exact pairwise forces
+// for FORCE_SAMPLES evenly spaced bodies, print the relative error and
+// return the largest one
+double report_force_error(int nbodies, const Body *bodies);
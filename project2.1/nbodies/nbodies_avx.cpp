@@ -0,0 +1,189 @@
+// nbodies simulation
+// Copyright 2009 Cilk Arts
+//
+// Modified by Cy Chan for 6.172
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <cmath>
+
+#include "common.h"
+#include <cilk/cilk.h>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define HAVE_SIMD_KERNEL
+#endif
+
+// The O(n^2) force calculation limits how many bodies are practical
+const int max_nbodies = 20000;
+
+// Primary state of the bodies.  It is loaded from bodies once, and again
+// by every calculate_forces only when an integrator in common.cpp moves
+// the bodies; update_positions writes it through to bodies as it goes.
+static BodySoA soa = { 0 };
+
+// Accumulate into (*fx, *fy) the force exerted on body i by bodies
+// j0 <= j < j1, one pair at a time, skipping j == i
+static inline void row_force_scalar(double *fx, double *fy, int i,
+                                    const BodySoA &s, int j0, int j1)
+{
+    const double xi = s.x[i], yi = s.y[i], mi = s.mass[i];
+    for (int j = j0; j < j1; ++j) {
+        if (j == i) continue;
+        double dx = make_nonzero(s.x[j] - xi);
+        double dy = make_nonzero(s.y[j] - yi);
+        double dist2 = dx * dx + dy * dy + softening2;
+        double dist = std::sqrt( dist2 );
+        double f = mi * s.mass[j] * GRAVITY / dist2;
+        *fx += f * dx / dist;
+        *fy += f * dy / dist;
+    }
+}
+
+#ifdef HAVE_SIMD_KERNEL
+// make_nonzero on four lanes
+static inline __m256d make_nonzero4(__m256d r)
+{
+    const __m256d threshold = _mm256_set1_pd(1.0e-100);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d small = _mm256_cmp_pd(_mm256_andnot_pd(sign, r), threshold,
+                                  _CMP_LT_OQ);
+    __m256d positive = _mm256_cmp_pd(r, _mm256_setzero_pd(), _CMP_GT_OQ);
+    __m256d fix = _mm256_blendv_pd(_mm256_xor_pd(threshold, sign),
+                                   threshold, positive);
+    return _mm256_blendv_pd(r, fix, small);
+}
+
+// 1 / sqrt(x) on four lanes: a single precision estimate refined by two
+// Newton steps, y' = y * (1.5 - 0.5 * x * y * y), to about 1e-14.  The
+// estimate is only good for x in float range: below FLT_MIN it gives inf,
+// above FLT_MAX 0.
+static inline __m256d rsqrt4(__m256d x)
+{
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d three_halves = _mm256_set1_pd(1.5);
+    __m256d y = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(x)));
+    __m256d hx = _mm256_mul_pd(half, x);
+    y = _mm256_mul_pd(y, _mm256_fnmadd_pd(hx, _mm256_mul_pd(y, y),
+                                          three_halves));
+    y = _mm256_mul_pd(y, _mm256_fnmadd_pd(hx, _mm256_mul_pd(y, y),
+                                          three_halves));
+    return y;
+}
+
+// Accumulate into (*fx, *fy) the force exerted on body i by bodies
+// 0 <= j < n4 (n4 a multiple of 4), four at a time.  The lane holding
+// body i itself is masked out.  Two bodies closer than about 1e-19
+// (possible without softening) underflow rsqrt4 and make the sums inf or
+// NaN; then return false and leave (*fx, *fy) alone.  Pairs beyond 1e19
+// get no force, far below the rounding of the others.
+static inline bool row_force_avx(double *fx, double *fy, int i,
+                                 const BodySoA &s, int n4)
+{
+    const __m256d xi = _mm256_set1_pd(s.x[i]);
+    const __m256d yi = _mm256_set1_pd(s.y[i]);
+    const __m256d gmi = _mm256_set1_pd(s.mass[i] * GRAVITY);
+    const __m256i self = _mm256_set1_epi64x(i);
+    __m256i lanes = _mm256_set_epi64x(3, 2, 1, 0);
+    const __m256i four = _mm256_set1_epi64x(4);
+    const __m256d eps2 = _mm256_set1_pd(softening2);
+    __m256d sx = _mm256_setzero_pd(), sy = _mm256_setzero_pd();
+    for (int j = 0; j < n4; j += 4) {
+        __m256d dx = make_nonzero4(_mm256_sub_pd(_mm256_load_pd(s.x + j), xi));
+        __m256d dy = make_nonzero4(_mm256_sub_pd(_mm256_load_pd(s.y + j), yi));
+        __m256d dist2 = _mm256_add_pd(
+            _mm256_fmadd_pd(dx, dx, _mm256_mul_pd(dy, dy)), eps2);
+        __m256d rinv = rsqrt4(dist2);
+        // f / dist = mi * mj * G / dist^3
+        __m256d f = _mm256_mul_pd(_mm256_mul_pd(gmi, _mm256_load_pd(s.mass + j)),
+                                  _mm256_mul_pd(rinv, _mm256_mul_pd(rinv, rinv)));
+        // clears the self lane even when its f is inf or NaN
+        __m256d keep = _mm256_castsi256_pd(_mm256_cmpeq_epi64(lanes, self));
+        f = _mm256_andnot_pd(keep, f);
+        sx = _mm256_fmadd_pd(f, dx, sx);
+        sy = _mm256_fmadd_pd(f, dy, sy);
+        lanes = _mm256_add_epi64(lanes, four);
+    }
+    double bx[4] __attribute__((aligned(32)));
+    double by[4] __attribute__((aligned(32)));
+    _mm256_store_pd(bx, sx);
+    _mm256_store_pd(by, sy);
+    double rx = (bx[0] + bx[1]) + (bx[2] + bx[3]);
+    double ry = (by[0] + by[1]) + (by[2] + by[3]);
+    if (!std::isfinite(rx) || !std::isfinite(ry))
+        return false;
+    *fx += rx;
+    *fy += ry;
+    return true;
+}
+#endif // HAVE_SIMD_KERNEL
+
+/* Calculate forces between all of the bodies in the simulation for all pairs.
+ * Each strand owns one row i, so no locks are needed. */
+void calculate_forces(int nbodies, Body *bodies) {
+    if (soa.n != nbodies) {
+        if (soa.n)
+            soa_free(&soa);
+        soa_alloc(&soa, nbodies);
+        soa_load(&soa, bodies);
+    } else if (integrator_moves_bodies) {
+        soa_load(&soa, bodies);
+    }
+
+#ifdef HAVE_SIMD_KERNEL
+    const int n4 = nbodies & ~3;
+#else
+    const int n4 = 0;
+#endif
+    const bool copy_forces = integrator_moves_bodies || check_forces;
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        double fx = 0.0, fy = 0.0;
+#ifdef HAVE_SIMD_KERNEL
+        if (!row_force_avx(&fx, &fy, i, soa, n4))
+            row_force_scalar(&fx, &fy, i, soa, 0, n4);
+#endif
+        row_force_scalar(&fx, &fy, i, soa, n4, nbodies);
+        soa.xf[i] = fx;
+        soa.yf[i] = fy;
+        if (copy_forces) {
+            bodies[i].xf = fx;
+            bodies[i].yf = fy;
+        }
+    }
+
+    static int step = 0;
+    if (check_forces && step++ % NSTEPS == 0) {
+        // compare against the scalar calculate_force on the Body array
+        if (report_force_error(nbodies, bodies) > FORCE_TOLERANCE) {
+            std::cerr << "nbodies: vector forces exceed tolerance "
+                      << FORCE_TOLERANCE << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Given sums of forces acting on all of the bodies, update their positions */
+void update_positions(int nbodies, Body *bodies)
+{
+    double *x = soa.x, *y = soa.y, *xv = soa.xv, *yv = soa.yv;
+    const double *xf = soa.xf, *yf = soa.yf, *mass = soa.mass;
+    cilk_for (int i=0; i<nbodies; ++i) {
+        // initial velocity
+        double xv0 = xv[i];
+        double yv0 = yv[i];
+        // update velocity based on forces
+        xv[i] += time_step * xf[i] / mass[i];
+        yv[i] += time_step * yf[i] / mass[i];
+        // update position based on average velocity
+        x[i] += time_step * (xv0 + xv[i])/2.0;
+        y[i] += time_step * (yv0 + yv[i])/2.0;
+        // keep bodies current for the images and checkpoints
+        bodies[i].x = x[i];
+        bodies[i].y = y[i];
+        bodies[i].xv = xv[i];
+        bodies[i].yv = yv[i];
+    }
+}
@@ -0,0 +1,259 @@
+// nbodies simulation
+// Copyright 2009 Cilk Arts
+//
+// Modified by Cy Chan for 6.172
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "common.h"
+#include <cilk/cilk.h>
+
+// Barnes-Hut approximates far-away groups of bodies by their center of
+// mass, so the force calculation is O(n log n)
+const int max_nbodies = 2000000;
+
+#define KEY_BITS 16        // quadtree depth limit (bits per coordinate)
+#define LEAF_SIZE 8        // bodies at or below which a cell is a leaf
+#define SPAWN_SIZE 4096    // smallest body range built by its own strand
+
+// A square cell of the quadtree.  The bodies it contains are the range
+// [first, last) of the Morton-sorted body order.
+struct Node {
+    double mass;      // total mass
+    double cx, cy;    // center of mass
+    double size;      // side length of the cell
+    int first, last;  // range of sorted bodies
+    Node *child[4];   // NULL for leaves
+};
+
+// Bodies sorted by Morton key, stored as arrays for locality
+static unsigned long long *order = NULL;   // (key << 32) | body index
+static double *sx = NULL, *sy = NULL, *smass = NULL;
+static int nsorted = 0;
+
+// Interleave the low KEY_BITS bits of ix and iy into a Morton key
+static inline unsigned int morton_key(unsigned int ix, unsigned int iy)
+{
+    unsigned int key = 0;
+    for (int b = KEY_BITS - 1; b >= 0; --b)
+        key = (key << 2) | (((iy >> b) & 1) << 1) | ((ix >> b) & 1);
+    return key;
+}
+
+// The quadrant (2 bits) of sorted body k at the given tree level
+static inline int quadrant(int k, int level)
+{
+    unsigned int key = (unsigned int) (order[k] >> 32);
+    return (key >> (2 * (KEY_BITS - 1 - level))) & 3;
+}
+
+// Build the subtree for sorted bodies [first, last), all of which share
+// the key prefix of a cell of the given side length at the given level.
+// Child cells are contiguous runs of the range, so they are built in
+// parallel without any locking.
+static Node *build(int first, int last, int level, double size)
+{
+    Node *node = new Node;
+    node->size = size;
+    node->first = first;
+    node->last = last;
+    for (int q = 0; q < 4; ++q)
+        node->child[q] = NULL;
+
+    if (last - first <= LEAF_SIZE || level == KEY_BITS) {
+        double m = 0.0, mx = 0.0, my = 0.0;
+        for (int k = first; k < last; ++k) {
+            m += smass[k];
+            mx += smass[k] * sx[k];
+            my += smass[k] * sy[k];
+        }
+        node->mass = m;
+        node->cx = mx / m;
+        node->cy = my / m;
+        return node;
+    }
+
+    // split the range at the points where the quadrant changes
+    int bounds[5];
+    bounds[0] = first;
+    for (int q = 1; q < 4; ++q) {
+        int lo = bounds[q - 1], hi = last;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (quadrant(mid, level) < q)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        bounds[q] = lo;
+    }
+    bounds[4] = last;
+
+    for (int q = 0; q < 4; ++q) {
+        if (bounds[q] == bounds[q + 1])
+            continue;
+        if (bounds[q + 1] - bounds[q] >= SPAWN_SIZE)
+            node->child[q] = cilk_spawn build(bounds[q], bounds[q + 1],
+                                              level + 1, size / 2);
+        else
+            node->child[q] = build(bounds[q], bounds[q + 1], level + 1,
+                                   size / 2);
+    }
+    cilk_sync;
+
+    double m = 0.0, mx = 0.0, my = 0.0;
+    for (int q = 0; q < 4; ++q) {
+        Node *c = node->child[q];
+        if (!c) continue;
+        m += c->mass;
+        mx += c->mass * c->cx;
+        my += c->mass * c->cy;
+    }
+    node->mass = m;
+    node->cx = mx / m;
+    node->cy = my / m;
+    return node;
+}
+
+static void destroy(Node *node)
+{
+    for (int q = 0; q < 4; ++q) {
+        if (node->child[q])
+            destroy(node->child[q]);
+    }
+    delete node;
+}
+
+// Accumulate the force of a point mass mj at (xj, yj) on the body at
+// (xi, yi) with mass mi into (*fx, *fy); same law as calculate_force
+static inline void add_point_force(double *fx, double *fy,
+                                   double xi, double yi, double mi,
+                                   double xj, double yj, double mj)
+{
+    double dx = make_nonzero(xj - xi);
+    double dy = make_nonzero(yj - yi);
+    double dist2 = dx * dx + dy * dy + softening2;
+    double dist = std::sqrt( dist2 );
+    double f = mi * mj * GRAVITY / dist2;
+    *fx += f * dx / dist;
+    *fy += f * dy / dist;
+}
+
+// Force on sorted body k from the bodies under node
+static void tree_force(double *fx, double *fy, int k, const Node *node,
+                       double theta2)
+{
+    const double xi = sx[k], yi = sy[k], mi = smass[k];
+    const Node *stack[4 * KEY_BITS + 4];
+    int top = 0;
+    stack[top++] = node;
+    while (top > 0) {
+        const Node *n = stack[--top];
+        if (!n->child[0] && !n->child[1] && !n->child[2] && !n->child[3]) {
+            for (int j = n->first; j < n->last; ++j) {
+                if (j == k) continue;
+                add_point_force(fx, fy, xi, yi, mi, sx[j], sy[j], smass[j]);
+            }
+            continue;
+        }
+        double dx = n->cx - xi, dy = n->cy - yi;
+        double d2 = dx * dx + dy * dy;
+        bool inside = k >= n->first && k < n->last;
+        if (!inside && n->size * n->size < theta2 * d2) {
+            // far enough away: treat the cell as one body
+            add_point_force(fx, fy, xi, yi, mi, n->cx, n->cy, n->mass);
+            continue;
+        }
+        for (int q = 0; q < 4; ++q) {
+            if (n->child[q])
+                stack[top++] = n->child[q];
+        }
+    }
+}
+
+/* Calculate forces between all of the bodies in the simulation, approximating
+ * the force of a cell of side s at distance d by its center of mass when
+ * s / d < opening_angle */
+void calculate_forces(int nbodies, Body *bodies) {
+    if (nsorted != nbodies) {
+        delete[] order;
+        delete[] sx;
+        delete[] sy;
+        delete[] smass;
+        order = new unsigned long long[nbodies];
+        sx = new double[nbodies];
+        sy = new double[nbodies];
+        smass = new double[nbodies];
+        nsorted = nbodies;
+    }
+
+    // bounding square of all bodies
+    double xmin = bodies[0].x, xmax = bodies[0].x;
+    double ymin = bodies[0].y, ymax = bodies[0].y;
+    for (int i = 1; i < nbodies; ++i) {
+        xmin = std::min(xmin, bodies[i].x);
+        xmax = std::max(xmax, bodies[i].x);
+        ymin = std::min(ymin, bodies[i].y);
+        ymax = std::max(ymax, bodies[i].y);
+    }
+    double size = std::max(xmax - xmin, ymax - ymin) * (1.0 + 1e-9) + 1e-9;
+    const double scale = (1 << KEY_BITS) / size;
+
+    // sort the bodies along the Morton curve of their quantized positions
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        unsigned int ix = (unsigned int) ((bodies[i].x - xmin) * scale);
+        unsigned int iy = (unsigned int) ((bodies[i].y - ymin) * scale);
+        ix = std::min(ix, (1u << KEY_BITS) - 1);
+        iy = std::min(iy, (1u << KEY_BITS) - 1);
+        order[i] = ((unsigned long long) morton_key(ix, iy) << 32) | i;
+    }
+    std::sort(order, order + nbodies);
+    cilk_for (int k = 0; k < nbodies; ++k) {
+        const Body &b = bodies[order[k] & 0xffffffffULL];
+        sx[k] = b.x;
+        sy[k] = b.y;
+        smass[k] = b.mass;
+    }
+
+    Node *root = build(0, nbodies, 0, size);
+
+    // each strand writes only the forces of its own body
+    const double theta2 = opening_angle * opening_angle;
+    cilk_for (int k = 0; k < nbodies; ++k) {
+        double fx = 0.0, fy = 0.0;
+        tree_force(&fx, &fy, k, root, theta2);
+        Body &b = bodies[order[k] & 0xffffffffULL];
+        b.xf = fx;
+        b.yf = fy;
+    }
+
+    destroy(root);
+
+    static int step = 0;
+    if (check_forces && step++ % NSTEPS == 0)
+        report_force_error(nbodies, bodies);
+}
+
+/* Given sums of forces acting on all of the bodies, update their positions */
+void update_positions(int nbodies, Body *bodies)
+{
+    cilk_for (int i=0; i<nbodies; ++i) {
+        // initial velocity
+        double xv0 = bodies[i].xv;
+        double yv0 = bodies[i].yv;
+        // update velocity based on forces
+        bodies[i].xv += time_step * bodies[i].xf / bodies[i].mass;
+        bodies[i].yv += time_step * bodies[i].yf / bodies[i].mass;
+        // clear forces for next iteration
+        bodies[i].xf = 0.0;
+        bodies[i].yf = 0.0;
+        // update position based on average velocity
+        bodies[i].x += time_step * (xv0 + bodies[i].xv)/2.0;
+        bodies[i].y += time_step * (yv0 + bodies[i].yv)/2.0;
+    }
+}
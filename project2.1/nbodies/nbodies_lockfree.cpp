@@ -0,0 +1,88 @@
+// nbodies simulation
+// Copyright 2009 Cilk Arts
+//
+// Modified by Cy Chan for 6.172
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <cmath>
+
+#include "common.h"
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+
+// The O(n^2) force calculation limits how many bodies are practical
+const int max_nbodies = 20000;
+
+// Per-worker force accumulators: worker w adds into xforces[w*n + i] and
+// yforces[w*n + i], so the symmetric update needs no lock.  They are
+// summed into the bodies, and cleared, after every force pass.
+static double *xforces = NULL, *yforces = NULL;
+static int nworkers = 0, nallocated = 0;
+
+/* Calculate forces between all of the bodies in the simulation for all pairs */
+void calculate_forces(int nbodies, Body *bodies) {
+    if (nallocated != nbodies || nworkers != __cilkrts_get_nworkers()) {
+        delete[] xforces;
+        delete[] yforces;
+        nworkers = __cilkrts_get_nworkers();
+        nallocated = nbodies;
+        xforces = new double[nworkers * nbodies]();
+        yforces = new double[nworkers * nbodies]();
+    }
+
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        // no spawns below, so the strand stays on one worker
+        const int w = __cilkrts_get_worker_number();
+        double *xf = xforces + w * nbodies;
+        double *yf = yforces + w * nbodies;
+        double fxi = 0.0, fyi = 0.0;
+        for (int j = 0; j < i; ++j) {
+            // update the force vector on bodies[i] exerted by bodies[j] and,
+            // symmetrically, the force vector on bodies[j] exerted by
+            // bodies[i].
+            double fx, fy;
+            calculate_force(&fx, &fy, bodies[i], bodies[j]);
+            fxi += fx;
+            fyi += fy;
+            xf[j] -= fx;
+            yf[j] -= fy;
+        }
+        xf[i] += fxi;
+        yf[i] += fyi;
+    }
+
+    // merge the per-worker forces
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        double fx = 0.0, fy = 0.0;
+        for (int w = 0; w < nworkers; ++w) {
+            fx += xforces[w * nbodies + i];
+            fy += yforces[w * nbodies + i];
+            xforces[w * nbodies + i] = 0.0;
+            yforces[w * nbodies + i] = 0.0;
+        }
+        bodies[i].xf += fx;
+        bodies[i].yf += fy;
+    }
+}
+
+/* Given sums of forces acting on all of the bodies, update their positions */
+void update_positions(int nbodies, Body *bodies)
+{
+    cilk_for (int i=0; i<nbodies; ++i) {
+        // initial velocity
+        double xv0 = bodies[i].xv;
+        double yv0 = bodies[i].yv;
+        // update velocity based on forces
+        bodies[i].xv += time_step * bodies[i].xf / bodies[i].mass;
+        bodies[i].yv += time_step * bodies[i].yf / bodies[i].mass;
+        // clear forces for next iteration
+        bodies[i].xf = 0.0;
+        bodies[i].yf = 0.0;
+        // update position based on average velocity
+        bodies[i].x += time_step * (xv0 + bodies[i].xv)/2.0;
+        bodies[i].y += time_step * (yv0 + bodies[i].yv)/2.0;
+    }
+}
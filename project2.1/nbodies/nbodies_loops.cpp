@@ -12,6 +12,9 @@
 #include "common.h"
 #include <cilk/cilk.h>
 
+// The O(n^2) force calculation limits how many bodies are practical
+const int max_nbodies = 20000;
+
 /* Calculate forces between all of the bodies in the simulation for all pairs */
 void calculate_forces(int nbodies, Body *bodies) {
     //#pragma cilk grainsize=1
@@ -35,13 +38,13 @@ void update_positions(int nbodies, Body *bodies)
         double xv0 = bodies[i].xv;
         double yv0 = bodies[i].yv;
         // update velocity based on forces
-        bodies[i].xv += TIME_QUANTUM * bodies[i].xf / bodies[i].mass;
-        bodies[i].yv += TIME_QUANTUM * bodies[i].yf / bodies[i].mass;
+        bodies[i].xv += time_step * bodies[i].xf / bodies[i].mass;
+        bodies[i].yv += time_step * bodies[i].yf / bodies[i].mass;
         // clear forces for next iteration
         bodies[i].xf = 0.0;
         bodies[i].yf = 0.0;
         // update position based on average velocity
-        bodies[i].x += TIME_QUANTUM * (xv0 + bodies[i].xv)/2.0;
-        bodies[i].y += TIME_QUANTUM * (yv0 + bodies[i].yv)/2.0;
+        bodies[i].x += time_step * (xv0 + bodies[i].xv)/2.0;
+        bodies[i].y += time_step * (yv0 + bodies[i].yv)/2.0;
     }
 }
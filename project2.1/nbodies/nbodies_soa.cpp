@@ -0,0 +1,99 @@
+// nbodies simulation
+// Copyright 2009 Cilk Arts
+//
+// Modified by Cy Chan for 6.172
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <cmath>
+
+#include "common.h"
+#include <cilk/cilk.h>
+
+// The O(n^2) force calculation limits how many bodies are practical
+const int max_nbodies = 20000;
+
+// Primary state of the bodies.  It is loaded from bodies once, and again
+// by every calculate_forces only when an integrator in common.cpp moves
+// the bodies; update_positions writes it through to bodies as it goes.
+static BodySoA soa = { 0 };
+
+// Accumulate into (*fx, *fy) the force exerted on the body at (xi, yi)
+// with mass mi by bodies j0 <= j < j1
+static inline void row_force(double *fx, double *fy,
+                             double xi, double yi, double mi,
+                             const BodySoA &s, int j0, int j1)
+{
+    double sx = *fx, sy = *fy;
+    for (int j = j0; j < j1; ++j) {
+        double dx = make_nonzero(s.x[j] - xi);
+        double dy = make_nonzero(s.y[j] - yi);
+
+        // compute distance between bodies
+        double dist2 = dx * dx + dy * dy + softening2;
+        double dist = std::sqrt( dist2 );
+
+        // law of gravitation
+        double f = mi * s.mass[j] * GRAVITY / dist2;
+
+        // separate force into components
+        sx += f * dx / dist;
+        sy += f * dy / dist;
+    }
+    *fx = sx;
+    *fy = sy;
+}
+
+/* Calculate forces between all of the bodies in the simulation for all pairs.
+ * Each strand owns one row i and sums the forces on body i in registers,
+ * so no two strands ever write the same force and no locks are needed. */
+void calculate_forces(int nbodies, Body *bodies) {
+    if (soa.n != nbodies) {
+        if (soa.n)
+            soa_free(&soa);
+        soa_alloc(&soa, nbodies);
+        soa_load(&soa, bodies);
+    } else if (integrator_moves_bodies) {
+        soa_load(&soa, bodies);
+    }
+
+    const bool copy_forces = integrator_moves_bodies;
+    cilk_for (int i = 0; i < nbodies; ++i) {
+        double fx = 0.0, fy = 0.0;
+        // skip j == i, a body exerts no force on itself
+        row_force(&fx, &fy, soa.x[i], soa.y[i], soa.mass[i], soa, 0, i);
+        row_force(&fx, &fy, soa.x[i], soa.y[i], soa.mass[i], soa,
+                  i + 1, nbodies);
+        soa.xf[i] = fx;
+        soa.yf[i] = fy;
+        if (copy_forces) {
+            bodies[i].xf = fx;
+            bodies[i].yf = fy;
+        }
+    }
+}
+
+/* Given sums of forces acting on all of the bodies, update their positions */
+void update_positions(int nbodies, Body *bodies)
+{
+    double *x = soa.x, *y = soa.y, *xv = soa.xv, *yv = soa.yv;
+    const double *xf = soa.xf, *yf = soa.yf, *mass = soa.mass;
+    cilk_for (int i=0; i<nbodies; ++i) {
+        // initial velocity
+        double xv0 = xv[i];
+        double yv0 = yv[i];
+        // update velocity based on forces
+        xv[i] += time_step * xf[i] / mass[i];
+        yv[i] += time_step * yf[i] / mass[i];
+        // update position based on average velocity
+        x[i] += time_step * (xv0 + xv[i])/2.0;
+        y[i] += time_step * (yv0 + yv[i])/2.0;
+        // keep bodies current for the images and checkpoints
+        bodies[i].x = x[i];
+        bodies[i].y = y[i];
+        bodies[i].xv = xv[i];
+        bodies[i].yv = yv[i];
+    }
+}
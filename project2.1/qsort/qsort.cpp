@@ -11,53 +11,341 @@
 #include <iterator>
 #include <functional>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <cmath>
 
 #include <cilktools/cilkview.h>
 #include <cilk/cilk.h>
 
 // Uncomment this to enable intentional race
-#define INTENTIONAL_RACE
+//#define INTENTIONAL_RACE
+
+// Default length below which sample_qsort stops spawning
+#define QSORT_GRAINSIZE 2048
+
+// Sample sort tuning parameters
+#define SAMPLESORT_CUTOFF 100000  // below this length just use std::sort
+#define SAMPLESORT_SPLITTERS 255  // maximum number of splitters
+#define SAMPLESORT_OVERSAMPLE 16  // samples drawn per splitter
+#define SAMPLESORT_BLOCK 65536    // elements per counting/scatter block
+
+// Number of distinct keys in the duplicates and zipf benchmark inputs
+#define DUPLICATE_KEYS 100
+#define ZIPF_KEYS 10000
+#define ZIPF_EXPONENT 1.0
 
 using namespace std;
 
+// Pivot selection strategies for sample_qsort
+typedef enum { PIVOT_LAST, PIVOT_MEDIAN3, PIVOT_NINTHER } PivotStrategy;
+
+// Serial sorts used once a range is at most grainSize long
+typedef enum { BASE_INSERTION, BASE_STDSORT } BaseCaseSort;
+
+// Tuning knobs for sample_qsort, settable from the command line.
+// pivot = PIVOT_LAST, threeWay = false and grainSize = 1 give the
+// original algorithm.
+struct QsortOptions {
+    PivotStrategy pivot;
+    bool threeWay;        // split into < pivot, == pivot and > pivot
+    long grainSize;       // ranges this short are sorted serially
+    BaseCaseSort baseCase;
+
+    QsortOptions() : pivot(PIVOT_NINTHER), threeWay(true),
+                     grainSize(QSORT_GRAINSIZE), baseCase(BASE_STDSORT) { }
+};
+
+// Sort the range between bidirectional iterators begin and end serially
+// with insertion sort.
+template <typename Iter>
+void insertion_sort(Iter begin, Iter end)
+{
+    typedef typename iterator_traits<Iter>::value_type T;
+
+    if (begin == end) return;
+    for (Iter i = begin + 1; i != end; ++i) {
+        T x = *i;
+        Iter j = i;
+        while (j != begin && x < *(j - 1)) {
+            *j = *(j - 1);
+            --j;
+        }
+        *j = x;
+    }
+}
+
+// Return whichever of a, b and c points at the median value.
+template <typename Iter>
+static inline Iter median_of_3(Iter a, Iter b, Iter c)
+{
+    if (*a < *b) {
+        if (*b < *c) return b;
+        return (*a < *c) ? c : a;
+    }
+    if (*a < *c) return a;
+    return (*b < *c) ? c : b;
+}
+
+// Pick the pivot of the non-empty range [begin, end) according to strategy.
+template <typename Iter>
+Iter choose_pivot(Iter begin, Iter end, PivotStrategy strategy)
+{
+    long n = end - begin;
+    Iter last = end - 1;
+    if (strategy == PIVOT_LAST || n < 3) {
+        return last;
+    }
+    Iter mid = begin + n / 2;
+    if (strategy == PIVOT_MEDIAN3 || n < 9) {
+        return median_of_3(begin, mid, last);
+    }
+    // Tukey's ninther: median of the medians of three groups of three
+    long step = n / 8;
+    return median_of_3(median_of_3(begin, begin + step, begin + 2 * step),
+                       median_of_3(mid - step, mid, mid + step),
+                       median_of_3(last - 2 * step, last - step, last));
+}
+
+// Partition [begin, end) around pivot into keys less than, equal to and
+// greater than it, returning the bounds of the equal range in lt and gt.
+template <typename Iter, typename T>
+void partition3(Iter begin, Iter end, const T &pivot, Iter *lt, Iter *gt)
+{
+    Iter lo = begin, i = begin, hi = end;
+    while (i != hi) {
+        if (*i < pivot) {
+            std::swap(*lo, *i);
+            ++lo;
+            ++i;
+        } else if (pivot < *i) {
+            --hi;
+            std::swap(*i, *hi);
+        } else {
+            ++i;
+        }
+    }
+    *lt = lo;
+    *gt = hi;
+}
+
 // Sort the range between bidirectional iterators begin and end.
 // end is one past the final element in the range.
 // Use the Quick Sort algorithm, using recursive divide and conquer.
 template <typename Iter>
-void sample_qsort(Iter begin, Iter end) {
+void sample_qsort(Iter begin, Iter end, const QsortOptions &opts) {
 
     typedef typename iterator_traits<Iter>::value_type T;
 
-    if (begin != end) {
+    if (end - begin <= opts.grainSize) {
+        // too little work left to be worth spawning
+        if (opts.baseCase == BASE_INSERTION) {
+            insertion_sort(begin, end);
+        } else {
+            std::sort(begin, end);
+        }
+        return;
+    }
 
-        // get last element
-        T last = *(end - 1);
+    // move the chosen pivot to the last element
+    std::swap(*choose_pivot(begin, end, opts.pivot), *(end - 1));
+    T last = *(end - 1);
+
+    if (opts.threeWay) {
+        // keys equal to the pivot are already in place
+        Iter lt, gt;
+        partition3(begin, end, last, &lt, &gt);
+        cilk_spawn sample_qsort(begin, lt, opts);
+        sample_qsort(gt, end, opts);
+        cilk_sync;
+        return;
+    }
 
-        // Partition array using last element of array as pivot
-        // (move elements less than last to lower partition
-        // and elements not less than last to upper partition
-        // return middle = the first element not less than last
-        Iter middle = std::partition(begin, end - 1,
-                                     bind2nd(less<T>(), last));
+    // Partition array using last element of array as pivot
+    // (move elements less than last to lower partition
+    // and elements not less than last to upper partition
+    // return middle = the first element not less than last
+    Iter middle = std::partition(begin, end - 1,
+                                 bind2nd(less<T>(), last));
 
-        // move pivot to middle
-        std::swap(*(end - 1), *middle);
+    // move pivot to middle
+    std::swap(*(end - 1), *middle);
 
-        // sort lower partition
+    // sort lower partition
 #ifdef INTENTIONAL_RACE
-        // INTENTIONAL RACE: Ranges overlap
-        cilk_spawn sample_qsort(begin, std::min(middle + 2, end - 1));
+    // INTENTIONAL RACE: Ranges overlap
+    cilk_spawn sample_qsort(begin, std::min(middle + 2, end - 1), opts);
 #else
-        cilk_spawn sample_qsort(begin, middle);
+    cilk_spawn sample_qsort(begin, middle, opts);
 #endif
-        // sort upper partition (excluding pivot)
-        sample_qsort(middle + 1, end);
-        cilk_sync;
+    // sort upper partition (excluding pivot)
+    sample_qsort(middle + 1, end, opts);
+    cilk_sync;
+}
+
+template <typename Iter>
+void sample_qsort(Iter begin, Iter end) {
+    sample_qsort(begin, end, QsortOptions());
+}
+
+// Small, fast pseudo-random number generator (xorshift64)
+struct XorShift64 {
+    unsigned long long state;
+
+    XorShift64(unsigned long long seed) : state(seed ? seed : 1) { }
+
+    unsigned long long next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
     }
+
+    // uniform double in [0, 1)
+    double nextDouble() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+// Return the bucket of x given nsplitters sorted, distinct splitters.
+// Even bucket 2j holds the keys strictly between splitters j-1 and j;
+// odd bucket 2j+1 holds the keys equal to splitter j.
+template <typename T>
+static inline int sample_sort_bucket(const T &x, const T *splitters,
+                                     int nsplitters)
+{
+    int j = std::lower_bound(splitters, splitters + nsplitters, x)
+            - splitters;
+    if (j < nsplitters && !(x < splitters[j]))
+        return 2 * j + 1;
+    return 2 * j;
 }
 
-void printArray(const int *a, size_t n)
+// Sort the range between random access iterators begin and end.
+// Use a parallel sample sort: pick splitters from an oversampled set of
+// keys, count bucket sizes over blocks of the input in parallel, scatter
+// every block into a temporary array in parallel and finally sort each
+// bucket independently.  Keys equal to a splitter land in a bucket of
+// their own that needs no sorting, so inputs with many duplicates stay
+// balanced.
+template <typename Iter>
+void sample_sort(Iter begin, Iter end)
+{
+    typedef typename iterator_traits<Iter>::value_type T;
+
+    long n = end - begin;
+    if (n < SAMPLESORT_CUTOFF) {
+        std::sort(begin, end);
+        return;
+    }
+
+    // draw the oversampled keys at pseudo-random positions
+    const int nsamples = SAMPLESORT_SPLITTERS * SAMPLESORT_OVERSAMPLE;
+    T *samples = new T[nsamples];
+    XorShift64 rng(88172645463325252ULL);
+    for (int i = 0; i < nsamples; ++i) {
+        samples[i] = begin[rng.next() % n];
+    }
+    std::sort(samples, samples + nsamples);
+
+    // take evenly spaced, distinct splitters from the sorted sample
+    T *splitters = new T[SAMPLESORT_SPLITTERS];
+    int nsplitters = 0;
+    for (int i = 0; i < SAMPLESORT_SPLITTERS; ++i) {
+        const T &s = samples[i * SAMPLESORT_OVERSAMPLE
+                             + SAMPLESORT_OVERSAMPLE / 2];
+        if (nsplitters == 0 || splitters[nsplitters - 1] < s)
+            splitters[nsplitters++] = s;
+    }
+    delete[] samples;
+
+    const int nbuckets = 2 * nsplitters + 1;
+    const long nblocks = (n + SAMPLESORT_BLOCK - 1) / SAMPLESORT_BLOCK;
+    unsigned short *ids = new unsigned short[n];
+    long *counts = new long[nblocks * nbuckets];
+    long *bucketStart = new long[nbuckets + 1];
+    T *tmp = new T[n];
+
+    // count the bucket sizes of every block, remembering each key's bucket
+    cilk_for (long blk = 0; blk < nblocks; ++blk) {
+        long *count = counts + blk * nbuckets;
+        std::fill(count, count + nbuckets, 0);
+        long last = std::min(n, (blk + 1) * SAMPLESORT_BLOCK);
+        for (long i = blk * SAMPLESORT_BLOCK; i < last; ++i) {
+            int b = sample_sort_bucket(begin[i], splitters, nsplitters);
+            ids[i] = (unsigned short) b;
+            ++count[b];
+        }
+    }
+
+    // turn the counts into the scatter offset of each (block, bucket)
+    long sum = 0;
+    for (int b = 0; b < nbuckets; ++b) {
+        bucketStart[b] = sum;
+        for (long blk = 0; blk < nblocks; ++blk) {
+            long c = counts[blk * nbuckets + b];
+            counts[blk * nbuckets + b] = sum;
+            sum += c;
+        }
+    }
+    bucketStart[nbuckets] = sum;
+
+    // scatter every block into its slots of the temporary array
+    cilk_for (long blk = 0; blk < nblocks; ++blk) {
+        long *offset = counts + blk * nbuckets;
+        long last = std::min(n, (blk + 1) * SAMPLESORT_BLOCK);
+        for (long i = blk * SAMPLESORT_BLOCK; i < last; ++i) {
+            tmp[offset[ids[i]]++] = begin[i];
+        }
+    }
+
+    // sort the buckets (equality buckets already are) and copy them back
+    cilk_for (int b = 0; b < nbuckets; ++b) {
+        T *first = tmp + bucketStart[b];
+        T *last = tmp + bucketStart[b + 1];
+        if (b % 2 == 0)
+            std::sort(first, last);
+        std::copy(first, last, begin + bucketStart[b]);
+    }
+
+    delete[] tmp;
+    delete[] bucketStart;
+    delete[] counts;
+    delete[] ids;
+    delete[] splitters;
+}
+
+// Sorting engines selectable from the command line
+typedef enum { QSORT, SAMPLESORT } SortEngine;
+
+const char *engineName(SortEngine engine)
+{
+    return engine == SAMPLESORT ? "sample_sort" : "sample_qsort";
+}
+
+template <typename Iter>
+void run_sort(SortEngine engine, Iter begin, Iter end,
+              const QsortOptions &opts)
+{
+    if (engine == SAMPLESORT) {
+        sample_sort(begin, end);
+    } else {
+        sample_qsort(begin, end, opts);
+    }
+}
+
+// Return the text after "name=" if arg is of that form, otherwise NULL.
+const char *optionValue(const char *arg, const char *name)
+{
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+        return arg + len + 1;
+    }
+    return NULL;
+}
+
+template <typename T>
+void printArray(const T *a, size_t n)
 {
     assert(a > 0);
     cout << "a: (" << a[0];
@@ -67,62 +355,113 @@ void printArray(const int *a, size_t n)
     cout << ")" << endl;
 }
 
-// A simple test harness.  Program takes 2 optional arguments:
-//   First argument specifies the length of the array to sort.
-//     Defaults to 10 million.
-//   Second argument specifies the number of trials to run.
-//     Defaults to 1.
-int main(int argc, char **argv)
+// Benchmark input distributions
+typedef enum { SHUFFLED, UNIFORM, SORTED, REVERSE, ORGAN_PIPE, ZIPF,
+               DUPLICATES, NUM_DISTRIBUTIONS } Distribution;
+
+const char *distributionNames[NUM_DISTRIBUTIONS] = {
+    "shuffled", "uniform", "sorted", "reverse", "organpipe", "zipf",
+    "duplicates"
+};
+
+// True for the inputs that make last-element pivoting quadratic
+bool isPresorted(Distribution dist)
 {
-    int *a = NULL, failCount = 0;
-    bool failFlag;
+    return dist == SORTED || dist == REVERSE || dist == ORGAN_PIPE;
+}
 
-    // get number of integers to sort, default 50 million
-    int n = 50*1000*1000;
-    if (argc > 1) {
-      n = atoi(argv[1]);
+// Fill a[0..n) with keys drawn from dist:
+//   shuffled    a random permutation of 0..n-1
+//   uniform     uniformly random non-negative keys over the whole key type
+//   sorted      0..n-1
+//   reverse     n-1..0
+//   organpipe   0, 1, ..., n/2, ..., 1, 0
+//   zipf        ranks 0..ZIPF_KEYS-1, rank r drawn with weight 1/(r+1)^s
+//   duplicates  a random permutation of (i % DUPLICATE_KEYS)
+template <typename T>
+void fill_input(T *a, long n, Distribution dist, XorShift64 &rng)
+{
+    switch (dist) {
+    case UNIFORM:
+        for (long i = 0; i < n; ++i) {
+            // drop the low bits and the sign bit of the key type
+            a[i] = T(rng.next() >> (65 - 8 * sizeof(T)));
+        }
+        break;
+    case SORTED:
+        for (long i = 0; i < n; ++i) a[i] = T(i);
+        break;
+    case REVERSE:
+        for (long i = 0; i < n; ++i) a[i] = T(n - 1 - i);
+        break;
+    case ORGAN_PIPE:
+        for (long i = 0; i < n; ++i) a[i] = T(std::min(i, n - 1 - i));
+        break;
+    case ZIPF: {
+        double *cdf = new double[ZIPF_KEYS];
+        double sum = 0;
+        for (int r = 0; r < ZIPF_KEYS; ++r) {
+            sum += 1.0 / pow(r + 1.0, ZIPF_EXPONENT);
+            cdf[r] = sum;
+        }
+        for (long i = 0; i < n; ++i) {
+            double u = rng.nextDouble() * sum;
+            a[i] = T(std::upper_bound(cdf, cdf + ZIPF_KEYS - 1, u) - cdf);
+        }
+        delete[] cdf;
+        break;
     }
-    cout << "Sorting " << n << " integers" << endl;
-
-    // get number of trials, default to 1
-    int numTrials = 1;
-    if (argc > 2) {
-        numTrials = atoi(argv[2]);
+    case DUPLICATES:
+        for (long i = 0; i < n; ++i) a[i] = T(i % DUPLICATE_KEYS);
+        std::random_shuffle(a, a + n);
+        break;
+    default:
+        for (long i = 0; i < n; ++i) a[i] = T(i);
+        std::random_shuffle(a, a + n);
+        break;
     }
-    cout << "Running " << numTrials << " trials" << endl;
+}
 
-    // check arguments
-    if (n < 1 || numTrials < 1) {
-        cerr << "array length and number of trials must be positive" << endl;
-        exit(-1);
-    }
+// Run one sort configuration: generate an input of length n from dist,
+// time std::sort on it to get the expected answer and a baseline, then
+// run warmup untimed and numTrials timed sorts with engine, verifying
+// each one.  Prints a human-readable summary and one RESULT line of
+// key=value pairs for scripts.  Returns the number of failed sorts.
+template <typename T>
+int benchmark(SortEngine engine, Distribution dist, int n, int warmup,
+              int numTrials, const QsortOptions &opts)
+{
+    T *input = new T[n];
+    T *expected = new T[n];
+    T *a = new T[n];
+    int failCount = 0;
+    XorShift64 rng(1);
+    cilkview_data_t start, end;
 
-    // allocate memory for array
-    a = new int[n];
-    if (!a) {
-        cerr << "array allocation failed" << endl;
-        exit(-1);
-    }
+    fill_input(input, n, dist, rng);
+
+    // baseline: serial std::sort, which also gives the expected output
+    std::copy(input, input + n, expected);
+    __cilkview_query(start);
+    std::sort(expected, expected + n);
+    __cilkview_query(end);
+    long long baseline_time = end.time - start.time;
 
-    // initialize to 0 to n-1
-    for (int i = 0; i < n; ++i) {
-      a[i] = i;
+    for (int j = 0; j < warmup; ++j) {
+        std::copy(input, input + n, a);
+        run_sort(engine, a, a + n, opts);
     }
 
-    long long int total_time = 0;
-    cilkview_data_t start, end;
-    // for each trial, shuffle data and sort it
+    long long total_time = 0;
     for (int j = 0; j < numTrials; ++j) {
-        // shuffle the data
-        std::random_shuffle(a, a + n);
+        std::copy(input, input + n, a);
 
 #ifdef DEBUG
         printArray(a, n);
 #endif
 
-        // run quicksort algorithm
         __cilkview_query(start);
-        sample_qsort(a, a + n);
+        run_sort(engine, a, a + n, opts);
         __cilkview_query(end);
         total_time += (end.time - start.time);
 
@@ -130,21 +469,196 @@ int main(int argc, char **argv)
         printArray(a, n);
 #endif
 
-        // Confirm that a is sorted and that each element contains the index.
-        failFlag = false;
-        for (int i = 0; i < n; ++i) {
-            if ( a[i] != i ) {
+        // Confirm that a matches the std::sort output
+        if (!std::equal(a, a + n, expected)) {
 #ifdef DEBUG
-                cout << "Sort failed at location i=" << i << " a[i] = "
-                    << a[i] << endl;
+            long i = std::mismatch(a, a + n, expected).first - a;
+            cout << "Sort failed at location i=" << i << " a[i] = "
+                 << a[i] << endl;
 #endif
-                failFlag = true;
+            ++failCount;
+        }
+    }
+
+    // times are in ms; clamp to 1 ms so tiny runs don't divide by zero
+    double seconds = std::max(total_time, 1LL) / 1000.0 / numTrials;
+    double baseline = std::max(baseline_time, 1LL) / 1000.0;
+    cout << distributionNames[dist] << " " << engineName(engine) << ": "
+         << seconds << " seconds per sort" << endl;
+    cout << "RESULT engine=" << engineName(engine)
+         << " dist=" << distributionNames[dist]
+         << " bits=" << 8 * sizeof(T)
+         << " n=" << n
+         << " trials=" << numTrials
+         << " seconds=" << seconds
+         << " elements_per_second=" << n / seconds
+         << " speedup_vs_std_sort=" << baseline / seconds
+         << " failed=" << failCount << endl;
+
+    delete[] a;
+    delete[] expected;
+    delete[] input;
+    return failCount;
+}
+
+// Run the requested engine on dist, or with compare set both engines on
+// every distribution.  Returns the number of failed sorts.
+template <typename T>
+int run_benchmarks(SortEngine engine, Distribution dist, bool compare,
+                   int n, int warmup, int numTrials,
+                   const QsortOptions &opts)
+{
+    if (!compare) {
+        return benchmark<T>(engine, dist, n, warmup, numTrials, opts);
+    }
+
+    int failCount = 0;
+    const SortEngine engines[] = { QSORT, SAMPLESORT };
+    for (int d = 0; d < NUM_DISTRIBUTIONS; ++d) {
+        for (int e = 0; e < 2; ++e) {
+            // last-element pivoting makes sample_qsort quadratic (and
+            // n levels deep) on presorted input
+            if (engines[e] == QSORT && opts.pivot == PIVOT_LAST &&
+                isPresorted(Distribution(d)) && n > 100000) {
+                cout << distributionNames[d] << " " << engineName(engines[e])
+                     << ": skipped (quadratic)" << endl;
+                continue;
             }
+            failCount += benchmark<T>(engines[e], Distribution(d), n,
+                                      warmup, numTrials, opts);
         }
-        if (failFlag) {
-            ++failCount;
+    }
+    return failCount;
+}
+
+// A simple test harness.  Program takes 2 optional arguments:
+//   First argument specifies the length of the array to sort.
+//     Defaults to 50 million.
+//   Second argument specifies the number of trials to run.
+//     Defaults to 1.
+// and the options:
+//   --samplesort  sort with sample_sort instead of sample_qsort
+//   --compare     time both sorts on every input distribution
+//   --dist=NAME   input distribution: shuffled (default), uniform, sorted,
+//                 reverse, organpipe, zipf or duplicates
+//   --keys=32|64  sort 32-bit (default) or 64-bit keys
+//   --warmup=N    untimed sorts before the timed trials (default 1)
+//   --pivot=last|median3|ninther   sample_qsort pivot (default ninther)
+//   --partition=2way|3way          sample_qsort partitioning (default 3way)
+//   --grain=N      sort ranges of at most N elements serially
+//                  (default 2048, 1 spawns down to single elements)
+//   --base=insertion|std           serial sort used below the grain size
+//                                  (default std::sort)
+int main(int argc, char **argv)
+{
+    int failCount = 0;
+    bool compare = false;
+    SortEngine engine = QSORT;
+    Distribution dist = SHUFFLED;
+    int keyBits = 32;
+    int warmup = 1;
+    QsortOptions opts;
+    const char *value;
+
+    // get number of integers to sort, default 50 million, and number of
+    // trials, default 1
+    int n = 50*1000*1000;
+    int numTrials = 1;
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--samplesort") == 0) {
+            engine = SAMPLESORT;
+        } else if (strcmp(argv[i], "--compare") == 0) {
+            compare = true;
+        } else if ((value = optionValue(argv[i], "--dist"))) {
+            int d = 0;
+            while (d < NUM_DISTRIBUTIONS &&
+                   strcmp(value, distributionNames[d]) != 0) {
+                ++d;
+            }
+            if (d == NUM_DISTRIBUTIONS) {
+                cerr << "unknown distribution: " << value << endl;
+                exit(-1);
+            }
+            dist = Distribution(d);
+        } else if ((value = optionValue(argv[i], "--keys"))) {
+            keyBits = atoi(value);
+            if (keyBits != 32 && keyBits != 64) {
+                cerr << "key width must be 32 or 64" << endl;
+                exit(-1);
+            }
+        } else if ((value = optionValue(argv[i], "--warmup"))) {
+            warmup = atoi(value);
+            if (warmup < 0) {
+                cerr << "warmup count must not be negative" << endl;
+                exit(-1);
+            }
+        } else if ((value = optionValue(argv[i], "--pivot"))) {
+            if (strcmp(value, "last") == 0) {
+                opts.pivot = PIVOT_LAST;
+            } else if (strcmp(value, "median3") == 0) {
+                opts.pivot = PIVOT_MEDIAN3;
+            } else if (strcmp(value, "ninther") == 0) {
+                opts.pivot = PIVOT_NINTHER;
+            } else {
+                cerr << "unknown pivot strategy: " << value << endl;
+                exit(-1);
+            }
+        } else if ((value = optionValue(argv[i], "--partition"))) {
+            if (strcmp(value, "2way") == 0) {
+                opts.threeWay = false;
+            } else if (strcmp(value, "3way") == 0) {
+                opts.threeWay = true;
+            } else {
+                cerr << "unknown partitioning: " << value << endl;
+                exit(-1);
+            }
+        } else if ((value = optionValue(argv[i], "--grain"))) {
+            opts.grainSize = atol(value);
+            if (opts.grainSize < 1) {
+                cerr << "grain size must be positive" << endl;
+                exit(-1);
+            }
+        } else if ((value = optionValue(argv[i], "--base"))) {
+            if (strcmp(value, "insertion") == 0) {
+                opts.baseCase = BASE_INSERTION;
+            } else if (strcmp(value, "std") == 0) {
+                opts.baseCase = BASE_STDSORT;
+            } else {
+                cerr << "unknown base case sort: " << value << endl;
+                exit(-1);
+            }
+        } else if (positional == 0) {
+            n = atoi(argv[i]);
+            ++positional;
+        } else if (positional == 1) {
+            numTrials = atoi(argv[i]);
+            ++positional;
+        } else {
+            cerr << "unknown argument: " << argv[i] << endl;
+            exit(-1);
         }
     }
+    cout << "Sorting " << n << " " << keyBits << "-bit integers" << endl;
+    cout << "Running " << warmup << " warmup and " << numTrials
+         << " timed trials" << endl;
+
+    // check arguments
+    if (n < 1 || numTrials < 1) {
+        cerr << "array length and number of trials must be positive" << endl;
+        exit(-1);
+    }
+
+    cilkview_data_t start, end;
+    __cilkview_query(start);
+    if (keyBits == 64) {
+        failCount = run_benchmarks<long long>(engine, dist, compare, n,
+                                              warmup, numTrials, opts);
+    } else {
+        failCount = run_benchmarks<int>(engine, dist, compare, n,
+                                        warmup, numTrials, opts);
+    }
+    __cilkview_query(end);
 
     if (failCount == 0) {
         cout << "All sorts succeeded" << endl;
@@ -152,15 +666,8 @@ int main(int argc, char **argv)
         cout << failCount << " sorts failed" << endl;
     }
 
-    // report time
-    //same problem as nbodies for report writing TODO
-    cout << "Sort time: " << total_time / 1000.0
-              << " seconds" << endl;
     __cilkview_do_report(&start, &end, "qsort", 
         CV_REPORT_WRITE_TO_LOG | CV_REPORT_WRITE_TO_RESULTS);
-    
-    // free integer array
-    delete[] a;
 
     return failCount;
 }
@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdexcept>
+#include <algorithm>
 
 #include "CollisionWorld.h"
 #include "IntersectionDetection.h"
@@ -21,6 +22,7 @@ CollisionWorld::CollisionWorld()
    timeStep = 1;
    maxQuadTreeRecursions = 7;  // Maximum recursion depth
    minElementsToSplit = 25;    // Minimum quadtree size
+   broadphase = QUADTREE_BROADPHASE;
 }
 
 
@@ -46,77 +48,99 @@ void CollisionWorld::updateLines()
 /****************************NEW FUNCTIONS BELOW HERE*********************/
 
 /**
- * Run the quadTree collision detection
- * Return the number of LineLineCollisions Found
+ * Build the quadtree node for the lines in quadLines[begin, end) and,
+ * recursively, its children.  The range is partitioned in place, stably,
+ * into the node's LEAF lines followed by the lines of each quadrant.
+ * Return the index of the node in quadNodes
  **/
-int CollisionWorld::quadTree(float xMax, float xMin, float yMax, float yMin, list<Line*> currentLines, int recursions)
+int CollisionWorld::buildQuadTree(float xMax, float xMin, float yMax, float yMin, unsigned int begin, unsigned int end, int recursions)
 {
-  if(recursions >= maxQuadTreeRecursions ||      // Maximum recursion depth 
-    currentLines.size() < minElementsToSplit){   // Minimum quadtree size
-    detectIntersectionNewSame(currentLines);
-    list<IntersectionInfo> intersections = detectIntersectionNewSame(currentLines);
-    return allCollisionSolver(intersections);
-  }
+  QuadNode node;
+  node.xMax = xMax; node.xMin = xMin; node.yMax = yMax; node.yMin = yMin;
+  node.split[0] = begin;
+  node.split[5] = end;
+  node.child[0] = node.child[1] = node.child[2] = node.child[3] = -1;
+  node.isLeaf = (recursions >= maxQuadTreeRecursions ||   // Maximum recursion depth
+                 end - begin < minElementsToSplit);       // Minimum quadtree size
+  int index = quadNodes.size();
+  quadNodes.push_back(node);
+  if (node.isLeaf)
+    return index;
+
   float xAvg = (xMax + xMin)/2;
   float yAvg = (yMax + yMin)/2;
-  
-  // Create a vector to hold lines that must sit in the current node
-  list<Line*> leafLines;
-  // Create 4 vectors to hold lines for child quadtree boxes
-  list<Line*> quad1, quad2, quad3, quad4;
-  // for each line
-  LineLocation location;
-  for (list<Line*>::iterator it = currentLines.begin(); it != currentLines.end(); ++it) {
-    // check where line should exist (lineInsideQuadrant)
-    location = lineInsideQuadrant(xMax, xMin, xAvg, yMax, yMin, yAvg, *it);
-    // if line is in a child quadtree add the line to one of the 4 arrays/vectors
-    if(location == QUAD1){quad1.push_back(*it);
-    }else if(location == QUAD2){quad2.push_back(*it);
-    }else if(location == QUAD3){quad3.push_back(*it);
-    }else if(location == QUAD4){quad4.push_back(*it);
-    }else if(location == LEAF){leafLines.push_back(*it);
-    }/*else{
-      printf("X must be between %f and %f\n", xMin, xMax);
-      //printf("p1X:%f\n",(*it).p1.x);
-      //printf("p2X:%f\n",(*it).p2.x);
-      printf("Y must be between %f and %f\n", yMin, yMax);
-      //printf("p1Y:%f\n",(*it).p1.y);
-      //printf("p2Y:%f\n\n",(*it).p2.y);
-      throw std::runtime_error::runtime_error("Bad Line passed down quadtree ");
-    }*/
+
+  // Counting sort of the range by location: LEAF first, then QUAD1..QUAD4
+  unsigned int count[5] = {0, 0, 0, 0, 0};
+  for (unsigned int i = begin; i < end; ++i) {
+    LineLocation location = lineInsideQuadrant(xMax, xMin, xAvg, yMax, yMin, yAvg, quadLines[i]);
+    unsigned int bucket = (location == LEAF) ? 0 : location - QUAD1 + 1;
+    quadScratch[i] = bucket;
+    ++count[bucket];
+  }
+  unsigned int next[5];
+  next[0] = begin;
+  for (int b = 1; b < 5; ++b) {
+    next[b] = next[b-1] + count[b-1];
+    node.split[b] = next[b];
   }
-  
-  // Spawn 4 recursions of quadTree with the 4 lists of lines
+  // Pack each bucket above its line index (so at most 2^28 lines) and
+  // scatter from quadScratch back into the range
+  for (unsigned int i = begin; i < end; ++i) {
+    quadScratch[i] = (quadScratch[i] << 28) | quadLines[i];
+  }
+  for (unsigned int i = begin; i < end; ++i) {
+    quadLines[next[quadScratch[i] >> 28]++] = quadScratch[i] & 0x0fffffff;
+  }
+
+  // Build child quadTrees for quadrants holding more than one line
   ++recursions;
-  int lineLineCollisions1 = 0;
-  int lineLineCollisions2 = 0;
-  int lineLineCollisions3 = 0;
-  int lineLineCollisions4 = 0;
-  list<Line*>::size_type vectorMin = 1;
-  // Create child quadTrees
-  if(quad1.size() > vectorMin) lineLineCollisions1 = cilk_spawn quadTree(xMax, xAvg, yMax, yAvg, quad1, recursions);
-  if(quad2.size() > vectorMin) lineLineCollisions2 = cilk_spawn quadTree(xAvg, xMin, yMax, yAvg, quad2, recursions);
-  if(quad3.size() > vectorMin) lineLineCollisions3 = cilk_spawn quadTree(xAvg, xMin, yAvg, yMin, quad3, recursions);
-  if(quad4.size() > vectorMin) lineLineCollisions4 = cilk_spawn quadTree(xMax, xAvg, yAvg, yMin, quad4, recursions);
-  cilk_sync;
-  int lineLineCollisions = lineLineCollisions1 + lineLineCollisions2 + lineLineCollisions3 + lineLineCollisions4;
-  
+  const float box[4][4] = {{xMax, xAvg, yMax, yAvg}, {xAvg, xMin, yMax, yAvg},
+                           {xAvg, xMin, yAvg, yMin}, {xMax, xAvg, yAvg, yMin}};
+  int child[4] = {-1, -1, -1, -1};
+  for (int k = 0; k < 4; ++k) {
+    if (node.split[k+2] - node.split[k+1] > 1) {
+      child[k] = buildQuadTree(box[k][0], box[k][1], box[k][2], box[k][3],
+                               node.split[k+1], node.split[k+2], recursions);
+    }
+  }
+  // quadNodes may have been reallocated by the recursion
+  quadNodes[index].split[1] = node.split[1];
+  quadNodes[index].split[2] = node.split[2];
+  quadNodes[index].split[3] = node.split[3];
+  quadNodes[index].split[4] = node.split[4];
+  for (int k = 0; k < 4; ++k) {
+    quadNodes[index].child[k] = child[k];
+  }
+  return index;
+}
+
+/**
+ * Run the quadTree collision detection on the subtree of node
+ * Nothing is solved until the whole tree is searched, so every node can
+ * run in parallel with its children
+ **/
+void CollisionWorld::quadTree(int node)
+{
+  const QuadNode &n = quadNodes[node];
+  vector<LinePair> &intersections = pairHits[node];
+  intersections.clear();
+  if (n.isLeaf) {
+    detectIntersectionNewSame(n.split[0], n.split[5], intersections);
+    return;
+  }
+
+  // Spawn the child quadTrees
+  for (int k = 0; k < 4; ++k) {
+    if (n.child[k] >= 0) cilk_spawn quadTree(n.child[k]);
+  }
+
   // Check for intersections within this box
-  list<IntersectionInfo> intersections = cilk_spawn detectIntersectionNewSame(leafLines);
-  
+  detectIntersectionNewSame(n.split[0], n.split[1], intersections);
+
   // Check child boxes' lines with current box's lines
-  list<IntersectionInfo> intersectionsquad1 = cilk_spawn detectIntersectionNew(leafLines, quad1);
-  list<IntersectionInfo> intersectionsquad2 = cilk_spawn detectIntersectionNew(leafLines, quad2);
-  list<IntersectionInfo> intersectionsquad3 = cilk_spawn detectIntersectionNew(leafLines, quad3);
-  list<IntersectionInfo> intersectionsquad4 = cilk_spawn detectIntersectionNew(leafLines, quad4);
+  detectIntersectionNew(n.split[0], n.split[1], n.split[1], n.split[5], intersections);
   cilk_sync;
-  
-  lineLineCollisions += allCollisionSolver(intersections);
-  lineLineCollisions += allCollisionSolver(intersectionsquad1);
-  lineLineCollisions += allCollisionSolver(intersectionsquad2);
-  lineLineCollisions += allCollisionSolver(intersectionsquad3);
-  lineLineCollisions += allCollisionSolver(intersectionsquad4);
-  return lineLineCollisions;
 }
 
 
@@ -131,12 +155,12 @@ int CollisionWorld::quadTree(float xMax, float xMin, float yMax, float yMin, lis
  * Return QUAD4 if line is insde fourth quadrant (between xMax, xAvg, yAvg, yMin)
  * If a line is exactly on a quadrant border (i.e. one of the axes), return LEAF
  **/
-inline LineLocation CollisionWorld::lineInsideQuadrant(float xMax, float xMin, float xAvg, float yMax, float yMin, float yAvg, Line *line){
+inline LineLocation CollisionWorld::lineInsideQuadrant(float xMax, float xMin, float xAvg, float yMax, float yMin, float yAvg, unsigned int id){
    // Math Stuff
-   double xMinVec = std::min(line->p1.x, line->p2.x);
-   double xMaxVec = std::max(line->p1.x, line->p2.x);
-   double yMinVec = std::min(line->p1.y, line->p2.y);
-   double yMaxVec = std::max(line->p1.y, line->p2.y);
+   double xMinVec = boxXMin[id];
+   double xMaxVec = boxXMax[id];
+   double yMinVec = boxYMin[id];
+   double yMaxVec = boxYMax[id];
 
    //test whether any point is outside the rectangle
    // We don't need to test this anymore because quadTrees never gives bad lines to children
@@ -170,78 +194,427 @@ inline LineLocation CollisionWorld::lineInsideQuadrant(float xMax, float xMin, f
  **/
 void CollisionWorld::detectIntersection()
 {
+   updateBoundingBoxes();
+   if (broadphase == GRID_BROADPHASE) {
+     gridDetect();
+     numLineLineCollisions += allCollisionSolver(getNumOfLines());
+     return;
+   }
+   if (broadphase == SWEEP_BROADPHASE) {
+     sweepDetect();
+     numLineLineCollisions += allCollisionSolver(getNumOfLines());
+     return;
+   }
+
    // Use the quadTree function instead of the default slow implementation
-   list<Line*> allLines;
-   for (vector<Line*>::iterator it = lines.begin(); it != lines.end(); ++it) {
-     allLines.push_back(*it);
+   const unsigned int n = getNumOfLines();
+   computeSweptBoxes();
+   quadLines.resize(n);
+   quadScratch.resize(n);
+   for (unsigned int i = 0; i < n; ++i) {
+     quadLines[i] = i;
    }
-   numLineLineCollisions += quadTree(BOX_XMAX, BOX_XMIN, BOX_YMAX, BOX_YMIN, allLines, 0);
+   quadNodes.clear();
+   int root = buildQuadTree(BOX_XMAX, BOX_XMIN, BOX_YMAX, BOX_YMIN, 0, n, 0);
+   if (pairHits.size() < quadNodes.size())
+     pairHits.resize(quadNodes.size());
+   quadTree(root);
+   numLineLineCollisions += allCollisionSolver(quadNodes.size());
 }
 
 
 /**
- * Test for intersection between each line in Line1 against each line in Lines2
+ * Select the broadphase used by detectIntersection
  **/
-inline list<IntersectionInfo> CollisionWorld::detectIntersectionNew(list<Line*> Lines1, list<Line*> Lines2)
+void CollisionWorld::setBroadphase(Broadphase b)
 {
-  list<IntersectionInfo> intersections;
-  for (list<Line*>::iterator it1 = Lines1.begin(); it1 != Lines1.end(); ++it1) {
-    list<Line*>::iterator it2;
-    for (it2 = Lines2.begin(); it2 != Lines2.end(); ++it2) {
-      IntersectionType intersectionType = intersect(*it1, *it2, timeStep);
-      if (intersectionType != NO_INTERSECTION) {
-         IntersectionInfo intersection = IntersectionInfo(*it1, *it2, intersectionType);
-         intersections.push_back(intersection);
+  broadphase = b;
+}
+
+/**
+ * Uniform grid broadphase.  Each line's swept box is binned into every
+ * cell it covers, and a pair of lines is tested only in the first cell
+ * (lowest x, then lowest y) their cell ranges share, so no pair is tested
+ * twice.  Any two lines that can meet within the time step have
+ * overlapping swept boxes, so the grid finds every collision.
+ **/
+void CollisionWorld::gridDetect()
+{
+  const unsigned int n = getNumOfLines();
+  if (pairHits.size() < n)
+    pairHits.resize(n);
+  if (n < 2) {
+    if (n == 1)
+      pairHits[0].clear();
+    return;
+  }
+
+  // Size the cells from the average line length, but bound the grid
+  double totalLength = 0;
+  for (unsigned int i = 0; i < n; ++i) {
+    totalLength += sqrt((p1x[i] - p2x[i]) * (p1x[i] - p2x[i]) + (p1y[i] - p2y[i]) * (p1y[i] - p2y[i]));
+  }
+  const double width = (double) BOX_XMAX - BOX_XMIN;
+  const double height = (double) BOX_YMAX - BOX_YMIN;
+  double cell = std::max(totalLength / n, width / MAX_GRID_CELLS);
+  const int nx = std::min((int) ceil(width / cell), MAX_GRID_CELLS);
+  const int ny = std::min((int) ceil(height / cell), MAX_GRID_CELLS);
+  const double invCell = 1.0 / cell;
+
+  // Swept boxes, and the number of lines in each cell
+  computeSweptBoxes();
+  gridCellStart.assign(nx * ny + 1, 0);
+  for (unsigned int i = 0; i < n; ++i) {
+    SweptBox &b = sweptBoxes[i];
+    // lines may be slightly outside the box before a wall collision
+    b.cellX0 = std::max(0, std::min(nx - 1, (int) ((b.xMin - BOX_XMIN) * invCell)));
+    b.cellX1 = std::max(0, std::min(nx - 1, (int) ((b.xMax - BOX_XMIN) * invCell)));
+    b.cellY0 = std::max(0, std::min(ny - 1, (int) ((b.yMin - BOX_YMIN) * invCell)));
+    b.cellY1 = std::max(0, std::min(ny - 1, (int) ((b.yMax - BOX_YMIN) * invCell)));
+    for (int cx = b.cellX0; cx <= b.cellX1; ++cx) {
+      for (int cy = b.cellY0; cy <= b.cellY1; ++cy) {
+        ++gridCellStart[cx * ny + cy + 1];
+      }
+    }
+  }
+
+  // Prefix sum into cell offsets, then fill the cells in line order
+  for (int c = 0; c < nx * ny; ++c) {
+    gridCellStart[c + 1] += gridCellStart[c];
+  }
+  gridLines.resize(gridCellStart[nx * ny]);
+  vector<unsigned int> next(gridCellStart.begin(), gridCellStart.end() - 1);
+  for (unsigned int i = 0; i < n; ++i) {
+    const SweptBox &b = sweptBoxes[i];
+    for (int cx = b.cellX0; cx <= b.cellX1; ++cx) {
+      for (int cy = b.cellY0; cy <= b.cellY1; ++cy) {
+        gridLines[next[cx * ny + cy]++] = i;
+      }
+    }
+  }
+
+  // Test each line against the later lines sharing its cells
+  cilk_for (unsigned int i = 0; i < n; ++i) {
+    const SweptBox &a = sweptBoxes[i];
+    vector<LinePair> &hits = pairHits[i];
+    hits.clear();
+    unsigned int tested = 0, rejected = 0;
+    for (int cx = a.cellX0; cx <= a.cellX1; ++cx) {
+      for (int cy = a.cellY0; cy <= a.cellY1; ++cy) {
+        const int c = cx * ny + cy;
+        for (unsigned int k = gridCellStart[c]; k < gridCellStart[c + 1]; ++k) {
+          unsigned int j = gridLines[k];
+          if (j <= i)
+            continue;
+          const SweptBox &b = sweptBoxes[j];
+          // only in the first shared cell
+          if (cx != std::max(a.cellX0, b.cellX0) || cy != std::max(a.cellY0, b.cellY0))
+            continue;
+          if (a.xMax < b.xMin || b.xMax < a.xMin || a.yMax < b.yMin || b.yMax < a.yMin) {
+            ++rejected;
+            continue;
+          }
+          ++tested;
+          IntersectionType intersectionType = intersectPair(i, j);
+          if (intersectionType != NO_INTERSECTION) {
+            hits.push_back(LinePair(i, j, intersectionType));
+          }
+        }
       }
     }
+    numPairsTested += tested;
+    numPairsRejected += rejected;
+  }
+}
+
+/**
+ * Compute the swept box of each line: the bounds of its position now and
+ * after moving by vel
+ **/
+void CollisionWorld::computeSweptBoxes()
+{
+  const unsigned int n = getNumOfLines();
+  sweptBoxes.resize(n);
+  for (unsigned int i = 0; i < n; ++i) {
+    // adding the step's motion rounds monotonically, so this is exactly
+    // the bound of both endpoints now and after moving
+    SweptBox &b = sweptBoxes[i];
+    b.xMin = boxXMin[i] + std::min(vx[i] * timeStep, 0.0);
+    b.xMax = boxXMax[i] + std::max(vx[i] * timeStep, 0.0);
+    b.yMin = boxYMin[i] + std::min(vy[i] * timeStep, 0.0);
+    b.yMax = boxYMax[i] + std::max(vy[i] * timeStep, 0.0);
   }
-  return intersections;
 }
 
 /**
- * Test for intersection between each line in Lines
+ * Whether the swept boxes of lines id1 and id2 overlap.  Two lines that
+ * meet at some time in the step are both at the meeting point then, so
+ * their swept boxes overlap; if they don't, intersect would return
+ * NO_INTERSECTION.
  **/
-inline list<IntersectionInfo> CollisionWorld::detectIntersectionNewSame(list<Line*> Lines){
-  list<IntersectionInfo> intersections;
-  for (list<Line*>::iterator it1 = Lines.begin(); it1 != Lines.end(); ++it1) {
-    list<Line*>::iterator it2 = it1;
-    ++it2;
-    for (it2; it2 != Lines.end(); ++it2) {
-       IntersectionType intersectionType = intersect(*it1, *it2, timeStep);
-       if (intersectionType != NO_INTERSECTION) {
-         IntersectionInfo intersection = IntersectionInfo(*it1, *it2, intersectionType);
-         intersections.push_back(intersection);
-       }
+inline bool CollisionWorld::sweptBoxesOverlap(unsigned int id1, unsigned int id2)
+{
+  const SweptBox &a = sweptBoxes[id1];
+  const SweptBox &b = sweptBoxes[id2];
+  return !(a.xMax < b.xMin || b.xMax < a.xMin || a.yMax < b.yMin || b.yMax < a.yMin);
+}
+
+// Orders line indices by the xMin of their swept boxes
+struct SweptBoxXMinLess {
+  explicit SweptBoxXMinLess(const vector<SweptBox> &boxes) : boxes(boxes) { }
+  bool operator()(unsigned int a, unsigned int b) const {
+    return boxes[a].xMin < boxes[b].xMin;
+  }
+  const vector<SweptBox> &boxes;
+};
+
+/**
+ * Sweep and prune broadphase.  sweepOrder is sorted by swept box xMin
+ * when the lines change, and stays nearly sorted between frames, so
+ * re-sorting it with insertion sort only moves the few lines that
+ * overtook a neighbour.  The sweep then tests each line against
+ * the following lines whose xMin is within its x extent, if their y
+ * extents overlap too.  Like the grid it finds every pair whose swept
+ * boxes overlap.
+ **/
+void CollisionWorld::sweepDetect()
+{
+  const unsigned int n = getNumOfLines();
+  computeSweptBoxes();
+  if (pairHits.size() < n)
+    pairHits.resize(n);
+
+  // Start over if lines were added or removed: line order is far from
+  // sorted, which would make insertion sort quadratic, so sort it fully
+  if (sweepOrder.size() != n) {
+    sweepOrder.resize(n);
+    for (unsigned int i = 0; i < n; ++i) {
+      sweepOrder[i] = i;
+    }
+    sort(sweepOrder.begin(), sweepOrder.end(), SweptBoxXMinLess(sweptBoxes));
+  } else {
+    for (unsigned int k = 1; k < n; ++k) {
+      unsigned int id = sweepOrder[k];
+      double key = sweptBoxes[id].xMin;
+      unsigned int m = k;
+      for (; m > 0 && sweptBoxes[sweepOrder[m-1]].xMin > key; --m) {
+        sweepOrder[m] = sweepOrder[m-1];
+      }
+      sweepOrder[m] = id;
+    }
+  }
+
+  cilk_for (unsigned int k = 0; k < n; ++k) {
+    const unsigned int a = sweepOrder[k];
+    const SweptBox &boxA = sweptBoxes[a];
+    vector<LinePair> &hits = pairHits[k];
+    hits.clear();
+    unsigned int tested = 0, rejected = 0;
+    for (unsigned int m = k + 1; m < n; ++m) {
+      const unsigned int b = sweepOrder[m];
+      const SweptBox &boxB = sweptBoxes[b];
+      if (boxB.xMin > boxA.xMax)
+        break;
+      if (boxA.yMax < boxB.yMin || boxB.yMax < boxA.yMin) {
+        ++rejected;
+        continue;
+      }
+      ++tested;
+      LinePair pair(a, b, NO_INTERSECTION);
+      pair.intersectionType = intersectPair(a, b);
+      if (pair.intersectionType != NO_INTERSECTION) {
+        hits.push_back(pair);
+      }
     }
+    numPairsTested += tested;
+    numPairsRejected += rejected;
   }
-  return intersections;
 }
 
 /**
- * Solve all of the collisions in the list<IntersectionInfo>
+ * Test line id against each line in quadLines[begin, end), a block of
+ * candidates at a time.  The candidates whose swept boxes don't overlap
+ * line id's are dropped first, and the rest go to intersectMany.
+ **/
+inline void CollisionWorld::intersectBlock(unsigned int id, unsigned int begin, unsigned int end, vector<LinePair> &intersections)
+{
+  const unsigned int blockSize = 64;
+  unsigned int candidates[blockSize];
+  IntersectionType results[blockSize];
+  unsigned int tested = 0;
+  for (unsigned int j = begin; j < end; j += blockSize) {
+    const unsigned int blockEnd = min(j + blockSize, end);
+    unsigned int count = 0;
+    for (unsigned int k = j; k < blockEnd; ++k) {
+      candidates[count] = quadLines[k];
+      count += sweptBoxesOverlap(id, quadLines[k]);
+    }
+    intersectMany(&frameLines[0], id, candidates, count, timeStep, results);
+    for (unsigned int k = 0; k < count; ++k) {
+      if (results[k] != NO_INTERSECTION) {
+        intersections.push_back(LinePair(id, candidates[k], results[k]));
+      }
+    }
+    tested += count;
+  }
+  if (end > begin) {
+    numPairsTested += tested;
+    numPairsRejected += (end - begin) - tested;
+  }
+}
+
+/**
+ * Test for intersection between each line in quadLines[begin1, end1)
+ * against each line in quadLines[begin2, end2)
+ **/
+inline void CollisionWorld::detectIntersectionNew(unsigned int begin1, unsigned int end1, unsigned int begin2, unsigned int end2, vector<LinePair> &intersections)
+{
+  for (unsigned int i = begin1; i < end1; ++i) {
+    intersectBlock(quadLines[i], begin2, end2, intersections);
+  }
+}
+
+/**
+ * Test for intersection between each line in quadLines[begin, end)
+ **/
+inline void CollisionWorld::detectIntersectionNewSame(unsigned int begin, unsigned int end, vector<LinePair> &intersections){
+  for (unsigned int i = begin; i < end; ++i) {
+    intersectBlock(quadLines[i], i + 1, end, intersections);
+  }
+}
+
+/**
+ * Solve all of the collisions in pairHits[0, lists).
+ *
+ * The collisions are sorted by (id1, id2), so the result doesn't depend on
+ * the broadphase's schedule.  Each collision goes in the batch after the
+ * last one using either of its lines.  A batch then never uses a line
+ * twice and can be solved in parallel, and every line still sees its
+ * collisions in sorted order, exactly as if they were solved one by one.
  * Return the number of line line collisions found
  **/
-inline int CollisionWorld::allCollisionSolver(list<IntersectionInfo> intersections){
-  list<IntersectionInfo>::iterator i;
-  for(i=intersections.begin(); i!=intersections.end(); ++i){// If we coarsen this loop, we can make it parallel
-    collisionSolver(i->l1, i->l2, i->intersectionType);
+int CollisionWorld::allCollisionSolver(unsigned int lists){
+  collisions.clear();
+  for (unsigned int k = 0; k < lists; ++k) {
+    collisions.insert(collisions.end(), pairHits[k].begin(), pairHits[k].end());
+  }
+  if (collisions.empty())
+    return 0;
+  sort(collisions.begin(), collisions.end());
+
+  // Greedy coloring, in sorted order, of the graph of collisions sharing
+  // a line
+  lineBatch.resize(getNumOfLines());
+  unsigned int batches = 0;
+  for (unsigned int h = 0; h < collisions.size(); ++h) {
+    LinePair &pair = collisions[h];
+    pair.batch = std::max(lineBatch[pair.id1], lineBatch[pair.id2]);
+    lineBatch[pair.id1] = lineBatch[pair.id2] = pair.batch + 1;
+    batches = std::max(batches, pair.batch + 1);
   }
-  return (int) intersections.size();
+  for (unsigned int h = 0; h < collisions.size(); ++h) {
+    lineBatch[collisions[h].id1] = lineBatch[collisions[h].id2] = 0;
+  }
+
+  // Stable counting sort into batches
+  batchStart.assign(batches + 1, 0);
+  for (unsigned int h = 0; h < collisions.size(); ++h) {
+    ++batchStart[collisions[h].batch + 1];
+  }
+  for (unsigned int b = 0; b < batches; ++b) {
+    batchStart[b + 1] += batchStart[b];
+  }
+  vector<LinePair> batched(collisions.size());
+  vector<unsigned int> next(batchStart.begin(), batchStart.end() - 1);
+  for (unsigned int h = 0; h < collisions.size(); ++h) {
+    batched[next[collisions[h].batch]++] = collisions[h];
+  }
+  collisions.swap(batched);
+
+  for (unsigned int b = 0; b < batches; ++b) {
+    cilk_for (unsigned int h = batchStart[b]; h < batchStart[b + 1]; ++h) {
+      const LinePair &pair = collisions[h];
+      Line l1, l2;
+      loadLine(pair.id1, &l1);
+      loadLine(pair.id2, &l2);
+      collisionSolver(&l1, &l2, pair.intersectionType);
+      vx[pair.id1] = l1.vel.x;
+      vy[pair.id1] = l1.vel.y;
+      vx[pair.id2] = l2.vel.x;
+      vy[pair.id2] = l2.vel.y;
+    }
+  }
+  return (int) collisions.size();
 }
 
 
+/**
+ * Copy line id out of the line arrays into *line
+ **/
+inline void CollisionWorld::loadLine(unsigned int id, Line *line)
+{
+  line->p1.x = p1x[id];
+  line->p1.y = p1y[id];
+  line->p2.x = p2x[id];
+  line->p2.y = p2y[id];
+  line->vel.x = vx[id];
+  line->vel.y = vy[id];
+  line->isGray = gray[id];
+}
+
+/**
+ * Run intersect on lines id1 and id2 as they were at the start of the
+ * frame, the line with the lower index first
+ **/
+inline IntersectionType CollisionWorld::intersectPair(unsigned int id1, unsigned int id2)
+{
+  if (id1 > id2)
+    std::swap(id1, id2);
+  return intersect(&frameLines[id1], &frameLines[id2], timeStep);
+}
+
+/**
+ * Recompute the bounding box of each line's segment, and frameLines, the
+ * Line records that intersection detection reads in place of the arrays
+ **/
+void CollisionWorld::updateBoundingBoxes()
+{
+  const unsigned int n = getNumOfLines();
+  frameLines.resize(n);
+  for (unsigned int i = 0; i < n; ++i) {
+    loadLine(i, &frameLines[i]);
+  }
+  boxXMin.resize(n);
+  boxXMax.resize(n);
+  boxYMin.resize(n);
+  boxYMax.resize(n);
+  const double *x1 = &p1x[0], *y1 = &p1y[0], *x2 = &p2x[0], *y2 = &p2y[0];
+  double *xMin = &boxXMin[0], *xMax = &boxXMax[0];
+  double *yMin = &boxYMin[0], *yMax = &boxYMax[0];
+  for (unsigned int i = 0; i < n; ++i) {
+    xMin[i] = std::min(x1[i], x2[i]);
+    xMax[i] = std::max(x1[i], x2[i]);
+    yMin[i] = std::min(y1[i], y2[i]);
+    yMax[i] = std::max(y1[i], y2[i]);
+  }
+}
+
 /************* NEW FUNCTIONS ABOVE HERE ****************/
 
 
 // Update line positions.
 inline void CollisionWorld::updatePosition()
 {
-   double t = timeStep;
-   vector<Line*>::iterator it;
-   for (it = lines.begin(); it != lines.end(); ++it) {
-      Line *line = *it;
-      line->p1 += (line->vel);
-      line->p2 += (line->vel);
+   const unsigned int n = getNumOfLines();
+   if (n == 0)
+      return;
+   double *x1 = &p1x[0], *y1 = &p1y[0], *x2 = &p2x[0], *y2 = &p2y[0];
+   const double *velx = &vx[0], *vely = &vy[0];
+   for (unsigned int i = 0; i < n; ++i) {
+      x1[i] += velx[i];
+      y1[i] += vely[i];
+      x2[i] += velx[i];
+      y2[i] += vely[i];
    }
 }
 
@@ -309,79 +682,85 @@ inline void CollisionWorld::collisionSolver(Line *l1, Line *l2, IntersectionType
 
 
 // Handle line to wall collisions
+// Each wall is checked in turn, exactly as the branches would, but with
+// selects so the loop vectorizes.
 inline void CollisionWorld::lineWallCollision()
 {
-   vector<Line*>::iterator it;
-   for (it = lines.begin(); it != lines.end(); ++it) {
-      Line *line   = *it;
-      bool collide = false;
+   const unsigned int n = getNumOfLines();
+   if (n == 0)
+      return;
+   const double *x1 = &p1x[0], *y1 = &p1y[0], *x2 = &p2x[0], *y2 = &p2y[0];
+   double *velx = &vx[0], *vely = &vy[0];
+   unsigned int collisions = 0;
+   for (unsigned int i = 0; i < n; ++i) {
+      double vxi = velx[i];
+      double vyi = vely[i];
 
       // Right side
-      if ((line->p1.x > BOX_XMAX  ||
-            line->p2.x > BOX_XMAX) &&
-            (line->vel.x > 0)) {
-         line->vel.x = -line->vel.x;
-         collide  = true;
-      }
+      bool right = (x1[i] > BOX_XMAX || x2[i] > BOX_XMAX) && vxi > 0;
+      vxi = right ? -vxi : vxi;
       // Left side
-      if ((line->p1.x < BOX_XMIN  ||
-            line->p2.x < BOX_XMIN) &&
-            (line->vel.x < 0)) {
-         line->vel.x = -line->vel.x;
-         collide  = true;
-      }
+      bool left = (x1[i] < BOX_XMIN || x2[i] < BOX_XMIN) && vxi < 0;
+      vxi = left ? -vxi : vxi;
       // Top side
-      if ((line->p1.y >  BOX_YMAX  ||
-            line->p2.y >  BOX_YMAX) &&
-            (line->vel.y > 0)) {
-         line->vel.y = -line->vel.y;
-         collide  = true;
-      }
+      bool top = (y1[i] > BOX_YMAX || y2[i] > BOX_YMAX) && vyi > 0;
+      vyi = top ? -vyi : vyi;
       // Bottom side
-      if ((line->p1.y < BOX_YMIN  ||
-            line->p2.y < BOX_YMIN) &&
-            (line->vel.y < 0)) {
-         line->vel.y = -line->vel.y;
-         collide  = true;
-      }
+      bool bottom = (y1[i] < BOX_YMIN || y2[i] < BOX_YMIN) && vyi < 0;
+      vyi = bottom ? -vyi : vyi;
+
+      velx[i] = vxi;
+      vely[i] = vyi;
       // Update total number of collisions
-      if (collide == true) {
-         numLineWallCollisions++;
-      }
+      collisions += (right | left | top | bottom);
    }
+   numLineWallCollisions += collisions;
 }
 
 
 // Return the total number of lines in the box
 unsigned int CollisionWorld::getNumOfLines()
 {
-   return lines.size();
+   return p1x.size();
 }
 
 
 // Add a line into the box
+// The line is copied into the line arrays and deleted
 void CollisionWorld::addLine(Line *line)
 {
-   lines.push_back(line);
+   p1x.push_back(line->p1.x);
+   p1y.push_back(line->p1.y);
+   p2x.push_back(line->p2.x);
+   p2y.push_back(line->p2.y);
+   vx.push_back(line->vel.x);
+   vy.push_back(line->vel.y);
+   gray.push_back(line->isGray);
+   delete line;
 }
 
 
 // Get the i-th line from the box
+// The line is a copy, valid until the next call
 Line *CollisionWorld::getLine(unsigned int index)
 {
-   if (index >= lines.size())
+   if (index >= getNumOfLines())
       return NULL;
-   return lines[index];
+   loadLine(index, &proxyLine);
+   return &proxyLine;
 }
 
 
 // Delete all lines in the box
 void CollisionWorld::deleteLines()
 {
-   for(vector<Line*>::iterator it = lines.begin(); it < lines.end(); it++){
-      delete *it;
-   }
-   lines.clear();
+   p1x.clear();
+   p1y.clear();
+   p2x.clear();
+   p2y.clear();
+   vx.clear();
+   vy.clear();
+   gray.clear();
 }
 
 
@@ -398,4 +777,16 @@ unsigned int CollisionWorld::getNumLineLineCollisions()
    return numLineLineCollisions;
 }
 
+// Get total number of line pairs tested with intersect
+unsigned long long CollisionWorld::getNumPairsTested()
+{
+   return numPairsTested.get_value();
+}
+
+// Get total number of line pairs rejected by their swept boxes
+unsigned long long CollisionWorld::getNumPairsRejected()
+{
+   return numPairsRejected.get_value();
+}
+
 
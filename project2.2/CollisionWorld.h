@@ -10,19 +10,50 @@ using namespace std;
 #include "Line.h"
 #include "IntersectionDetection.h"
 #include <cilk/reducer_list.h>
+#include <cilk/reducer_opadd.h>
 
 /***************NEW FUNCTIONS BELOW HERE**********************/
+// Largest number of uniform grid cells along each side of the box
+#define MAX_GRID_CELLS 256
+
 typedef enum { OUTSIDE, LEAF, QUAD1, QUAD2, QUAD3, QUAD4 } LineLocation;
-struct IntersectionInfo {
-  Line *l1;
-  Line *l2;
+
+// Broadphase used to find the pairs of lines passed to intersect
+typedef enum { QUADTREE_BROADPHASE, GRID_BROADPHASE, SWEEP_BROADPHASE } Broadphase;
+
+// A quadtree node over a range of CollisionWorld::quadLines.  The lines of
+// the node's subtree are quadLines[split[0], split[5]).  An interior node
+// keeps its straddling (LEAF) lines in [split[0], split[1]) and the lines of
+// quadrant k (QUAD1 + k) in [split[k+1], split[k+2]); a leaf node keeps all
+// of its lines unsplit.
+struct QuadNode {
+  float xMax, xMin, yMax, yMin;
+  bool isLeaf;
+  unsigned int split[6];
+  int child[4];   // index in quadNodes, or -1 if the quadrant isn't recursed
+};
+
+// An intersection between lines[id1] and lines[id2], id1 < id2, and the
+// batch it is solved in
+struct LinePair {
+  LinePair() { }
+  LinePair(unsigned int a, unsigned int b, IntersectionType type)
+    : id1(a < b ? a : b), id2(a < b ? b : a), intersectionType(type) { }
+  unsigned int id1;
+  unsigned int id2;
   IntersectionType intersectionType;
-  IntersectionInfo(Line *l1, Line *l2, IntersectionType intersectionType) {
-    this->l1 = l1;
-    this->l2 = l2;
-    this->intersectionType = intersectionType;
+  unsigned int batch;
+  bool operator<(const LinePair &other) const {
+    return id1 < other.id1 || (id1 == other.id1 && id2 < other.id2);
   }
 };
+
+// Bounding box of a line over one time step (its current position and its
+// position plus vel) and the range of grid cells the box covers
+struct SweptBox {
+  double xMin, xMax, yMin, yMax;
+  int cellX0, cellX1, cellY0, cellY1;
+};
 /**************NEW FUNCTIONS ABOVE HERE*********************/
 
 
@@ -38,14 +69,37 @@ protected:
    // Time step used for simulation
    int  timeStep;
 
-   // Container holding all the lines
-   vector<Line*> lines;
+   // All the lines, as structure of arrays: line i runs from
+   // (p1x[i], p1y[i]) to (p2x[i], p2y[i]) with velocity (vx[i], vy[i]).
+   // Only updatePosition, lineWallCollision and the bounding boxes read
+   // these arrays; intersection detection reads frameLines
+   vector<double> p1x, p1y, p2x, p2y;
+   vector<double> vx, vy;
+   vector<char> gray;
+
+   // Bounding box of each line's segment, refreshed every frame
+   vector<double> boxXMin, boxXMax, boxYMin, boxYMax;
+
+   // Copy of a line returned by getLine
+   Line proxyLine;
+
+   // Array of structures copy of every line, rebuilt from the arrays
+   // above before each detection.  intersect and intersectMany take Line
+   // records, so the broadphases and the solver read lines only from
+   // here, contiguous and unchanged by the collisions being solved
+   vector<Line> frameLines;
 
    // Record the total number of line wall collision
    unsigned int numLineWallCollisions;
 
    // Record the total number of line line intersection
    unsigned int numLineLineCollisions;
+
+   // Total number of candidate pairs from the broadphase given to
+   // intersect, and rejected before it because their swept boxes don't
+   // overlap
+   cilk::reducer_opadd<unsigned long long> numPairsTested;
+   cilk::reducer_opadd<unsigned long long> numPairsRejected;
    
    // Maximum number of recursions of a quadtree before the it gives up and 
    // manually checks for collisions
@@ -53,7 +107,41 @@ protected:
    
    // Minimum number of elements in a quad tree before it gives up and 
    // manully checks for collisions
-   vector<Line*>::size_type minElementsToSplit;
+   unsigned int minElementsToSplit;
+
+   // Indices into lines, partitioned in place into quadtree node ranges
+   vector<unsigned int> quadLines;
+
+   // Scratch space for partitioning quadLines
+   vector<unsigned int> quadScratch;
+
+   // Nodes of the quadtree, root first
+   vector<QuadNode> quadNodes;
+
+   // Broadphase used by detectIntersection
+   Broadphase broadphase;
+
+   // Uniform grid: swept box of each line, and the lines binned in each
+   // cell, cell c holding gridLines[gridCellStart[c], gridCellStart[c+1])
+   vector<SweptBox> sweptBoxes;
+   vector<unsigned int> gridCellStart;
+   vector<unsigned int> gridLines;
+
+   // Sweep and prune: line indices sorted by swept box xMin, kept from
+   // frame to frame
+   vector<unsigned int> sweepOrder;
+
+   // Intersections found by the broadphase, one list per strand of its
+   // parallel loop (per quadtree node, grid line or sweep position)
+   vector<vector<LinePair> > pairHits;
+
+   // All intersections of the frame, in solving order, and the start of
+   // each batch of them
+   vector<LinePair> collisions;
+   vector<unsigned int> batchStart;
+
+   // Last batch each line was used in, plus one (0 if not yet used)
+   vector<unsigned int> lineBatch;
    
 
 public:
@@ -62,10 +150,10 @@ public:
    // Return the total number of lines in the box
    unsigned int getNumOfLines();
 
-   // Add a line into the box
+   // Add a line into the box, taking ownership of it
    void  addLine(Line *line);
 
-   // Get a line from box
+   // Get a copy of a line from box, valid until the next call
    Line *getLine(unsigned int index);
 
    // Delete all lines in the box
@@ -89,14 +177,55 @@ public:
    // Get total number of line line intersection
    unsigned int getNumLineLineCollisions();
 
+   // Get total number of line pairs tested with intersect
+   unsigned long long getNumPairsTested();
+
+   // Get total number of line pairs rejected by their swept boxes
+   unsigned long long getNumPairsRejected();
+
    void collisionSolver(Line *l1, Line *l2, IntersectionType intersectionType);
 
 
 
    /**** NEW FUNCTIONS BELOW HERE ****/
 
-   // Run quadTree recursive function
-   int quadTree(float xMax, float xMin, float yMax, float yMin, list<Line*> currentLines, int recursions);
+   // Copy line id out of the line arrays into *line
+   void loadLine(unsigned int id, Line *line);
+
+   // Run intersect on lines id1 and id2 of frameLines, lower index first
+   IntersectionType intersectPair(unsigned int id1, unsigned int id2);
+
+   // Recompute boxXMin, boxXMax, boxYMin, boxYMax and frameLines
+   void updateBoundingBoxes();
+
+   // Select the broadphase used by detectIntersection
+   void setBroadphase(Broadphase b);
+
+   // Bin the lines' swept boxes into a uniform grid sized from the average
+   // line length and detect the collisions between lines sharing a cell
+   // into pairHits[0, lines.size())
+   void gridDetect();
+
+   // Compute sweptBoxes for all lines (the grid cells are left unset)
+   void computeSweptBoxes();
+
+   // Whether the swept boxes of lines id1 and id2 overlap, which they do
+   // if the lines can intersect within the time step
+   bool sweptBoxesOverlap(unsigned int id1, unsigned int id2);
+
+   // Sort sweepOrder by swept box xMin, fully when the lines changed and
+   // else by insertion sort, which is nearly linear as lines move little
+   // between frames, then sweep along x testing the
+   // lines whose x and y extents overlap, into pairHits[0, lines.size())
+   void sweepDetect();
+
+   // Build the quadtree node for the lines in quadLines[begin, end), 
+   // partitioning them in place, and return its index in quadNodes
+   int buildQuadTree(float xMax, float xMin, float yMax, float yMin, unsigned int begin, unsigned int end, int recursions);
+
+   // Detect the collisions in the subtree of a quadtree node, each node
+   // into pairHits[node]
+   void quadTree(int node);
 
    // Given a quadtree box and a line, find if a line is inside of a quadrant
    // Use LineLocations
@@ -107,20 +236,26 @@ public:
    // Return QUAD3 if line is inside third quadrant (between xAvg, xMin, yAvg, yMin)
    // Return QUAD4 if line is insde fourth quadrant (between xMax, xAvg, yAvg, yMin)
    // If a line is exactly on a quadrant border (i.e. one of the axes), return LEAF
-   LineLocation lineInsideQuadrant(float xMax, float xMin, float xAvg, float yMax, float yMin, float yAvg, Line *line);
+   LineLocation lineInsideQuadrant(float xMax, float xMin, float xAvg, float yMax, float yMin, float yAvg, unsigned int id);
    
-   // Test for intersection between each line in Line1 against each line in Lines2
-   list<IntersectionInfo> detectIntersectionNew(list<Line*> Lines1, list<Line*> Lines2);
+   // Test line id against each line in quadLines[begin, end) whose swept
+   // box overlaps its own with intersectMany, adding the intersections
+   // found
+   void intersectBlock(unsigned int id, unsigned int begin, unsigned int end, vector<LinePair> &intersections);
+
+   // Test for intersection between each line in quadLines[begin1, end1)
+   // against each line in quadLines[begin2, end2)
+   void detectIntersectionNew(unsigned int begin1, unsigned int end1, unsigned int begin2, unsigned int end2, vector<LinePair> &intersections);
    
-   // Test for intersection between each line in Lines
-   list<IntersectionInfo> detectIntersectionNewSame(list<Line*> Lines);  
+   // Test for intersection between each line in quadLines[begin, end)
+   void detectIntersectionNewSame(unsigned int begin, unsigned int end, vector<LinePair> &intersections);
    
    /**
-   * Solve all of the collisions in the list<IntersectionInfo>
+   * Gather pairHits[0, lists) into one list sorted by (id1, id2) and solve
+   * it in batches of pairs sharing no line, each batch in parallel
+   * Return the number of line line collisions found
    **/
-  int allCollisionSolver(list<IntersectionInfo> intersections);
-  
-  void smallCollisionSolver(int *i, _List_iterator<IntersectionInfo> distance);
+  int allCollisionSolver(unsigned int lists);
 };
 
 
@@ -2,6 +2,10 @@
 #include "Line.h"
 #include "Vec.h"
 
+#if defined(__AVX2__) && !defined(FIXED_POINT)
+#include <immintrin.h>
+#endif
+
 // Detect if lines l1 and l2 will be intersected between now and the
 // next time step.
 IntersectionType intersect(Line *l1, Line *l2, int time)
@@ -23,21 +27,25 @@ IntersectionType intersect(Line *l1, Line *l2, int time)
    p1 = l2->p1 + (vel * time);
    p2 = l2->p2 + (vel * time);
 
+   // The points as the predicates see them, converted once
+   Point a1 = l1->p1, a2 = l1->p2, b1 = l2->p1, b2 = l2->p2;
+   Point q1 = p1, q2 = p2;
+
    int num_line_intersections = 0;
    bool top_intersected = false;
    bool bottom_intersected = false;
 
-   if (intersectLines(l1->p1, l1->p2, l2->p1, l2->p2)) {
+   if (intersectLines(a1, a2, b1, b2)) {
       return ALREADY_INTERSECTED;
    }
-   if (intersectLines(l1->p1, l1->p2, p1, p2)) {
+   if (intersectLines(a1, a2, q1, q2)) {
       num_line_intersections++;
    }
-   if (intersectLines(l1->p1, l1->p2, p1, l2->p1)) {
+   if (intersectLines(a1, a2, q1, b1)) {
       num_line_intersections++;
       top_intersected = true;
    }
-   if (intersectLines(l1->p1, l1->p2, p2, l2->p2)) {
+   if (intersectLines(a1, a2, q2, b2)) {
       num_line_intersections++;
       bottom_intersected = true;
    }
@@ -46,8 +54,8 @@ IntersectionType intersect(Line *l1, Line *l2, int time)
       return L2_WITH_L1;
    }
 
-   if (pointInParallelogram(l1->p1, l2->p1, l2->p2, p1, p2) &&
-         pointInParallelogram(l1->p2, l2->p1, l2->p2, p1, p2)) {
+   if (pointInParallelogram(a1, b1, b2, q1, q2) &&
+         pointInParallelogram(a2, b1, b2, q1, q2)) {
 
       return L1_WITH_L2;
    }
@@ -77,15 +85,178 @@ IntersectionType intersect(Line *l1, Line *l2, int time)
    return L1_WITH_L2;
 }
 
+#if defined(__AVX2__) && !defined(FIXED_POINT)
+// The helpers below are direction, onSegment, intersectLines and
+// pointInParallelogram on four lanes of doubles, with each comparison
+// result a lane mask.  They use separate multiplies and subtracts, like
+// the scalar code, so they round the same.
+struct Vec4 {
+   __m256d x, y;
+};
+
+static inline __m256d direction4(Vec4 pi, Vec4 pj, Vec4 pk)
+{
+   return _mm256_sub_pd(
+            _mm256_mul_pd(_mm256_sub_pd(pk.x, pi.x), _mm256_sub_pd(pj.y, pi.y)),
+            _mm256_mul_pd(_mm256_sub_pd(pj.x, pi.x), _mm256_sub_pd(pk.y, pi.y)));
+}
+
+// (d1, d2) and (d3, d4) each have strictly opposite signs
+static inline __m256d straddle4(__m256d d1, __m256d d2,
+                                __m256d d3, __m256d d4)
+{
+   const __m256d zero = _mm256_setzero_pd();
+   __m256d s12 = _mm256_or_pd(
+         _mm256_and_pd(_mm256_cmp_pd(d1, zero, _CMP_GT_OQ),
+                       _mm256_cmp_pd(d2, zero, _CMP_LT_OQ)),
+         _mm256_and_pd(_mm256_cmp_pd(d1, zero, _CMP_LT_OQ),
+                       _mm256_cmp_pd(d2, zero, _CMP_GT_OQ)));
+   __m256d s34 = _mm256_or_pd(
+         _mm256_and_pd(_mm256_cmp_pd(d3, zero, _CMP_GT_OQ),
+                       _mm256_cmp_pd(d4, zero, _CMP_LT_OQ)),
+         _mm256_and_pd(_mm256_cmp_pd(d3, zero, _CMP_LT_OQ),
+                       _mm256_cmp_pd(d4, zero, _CMP_GT_OQ)));
+   return _mm256_and_pd(s12, s34);
+}
+
+// a <= b <= c or c <= b <= a
+static inline __m256d between4(__m256d a, __m256d b, __m256d c)
+{
+   return _mm256_or_pd(
+         _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LE_OQ),
+                       _mm256_cmp_pd(b, c, _CMP_LE_OQ)),
+         _mm256_and_pd(_mm256_cmp_pd(c, b, _CMP_LE_OQ),
+                       _mm256_cmp_pd(b, a, _CMP_LE_OQ)));
+}
+
+// d == 0 and pk is in the bounding box of (pi, pj)
+static inline __m256d onSegment4(__m256d d, Vec4 pi, Vec4 pj, Vec4 pk)
+{
+   return _mm256_and_pd(_mm256_cmp_pd(d, _mm256_setzero_pd(), _CMP_EQ_OQ),
+                        _mm256_and_pd(between4(pi.x, pk.x, pj.x),
+                                      between4(pi.y, pk.y, pj.y)));
+}
+
+static inline __m256d intersectLines4(Vec4 p1, Vec4 p2, Vec4 p3, Vec4 p4)
+{
+   __m256d d1 = direction4(p3, p4, p1);
+   __m256d d2 = direction4(p3, p4, p2);
+   __m256d d3 = direction4(p1, p2, p3);
+   __m256d d4 = direction4(p1, p2, p4);
+   __m256d hit = straddle4(d1, d2, d3, d4);
+   hit = _mm256_or_pd(hit, onSegment4(d1, p3, p4, p1));
+   hit = _mm256_or_pd(hit, onSegment4(d2, p3, p4, p2));
+   hit = _mm256_or_pd(hit, onSegment4(d3, p1, p2, p3));
+   hit = _mm256_or_pd(hit, onSegment4(d4, p1, p2, p4));
+   return hit;
+}
+
+static inline __m256d pointInParallelogram4(Vec4 point, Vec4 p1, Vec4 p2,
+                                            Vec4 p3, Vec4 p4)
+{
+   return straddle4(direction4(p1, p2, point), direction4(p3, p4, point),
+                    direction4(p1, p3, point), direction4(p2, p4, point));
+}
+
+// Test lines a[k] against b[k] for the four lanes k, as intersect(a[k],
+// b[k], time).  Lanes needing the angle between the lines are finished by
+// the scalar intersect.
+static void intersect4(const Line *a[4], const Line *b[4], int time,
+                       IntersectionType *results)
+{
+   double in[12][4] __attribute__((aligned(32)));
+   for (int k = 0; k < 4; ++k) {
+      in[0][k] = a[k]->p1.x;  in[1][k] = a[k]->p1.y;
+      in[2][k] = a[k]->p2.x;  in[3][k] = a[k]->p2.y;
+      in[4][k] = a[k]->vel.x; in[5][k] = a[k]->vel.y;
+      in[6][k] = b[k]->p1.x;  in[7][k] = b[k]->p1.y;
+      in[8][k] = b[k]->p2.x;  in[9][k] = b[k]->p2.y;
+      in[10][k] = b[k]->vel.x; in[11][k] = b[k]->vel.y;
+   }
+   Vec4 a1 = { _mm256_load_pd(in[0]), _mm256_load_pd(in[1]) };
+   Vec4 a2 = { _mm256_load_pd(in[2]), _mm256_load_pd(in[3]) };
+   Vec4 b1 = { _mm256_load_pd(in[6]), _mm256_load_pd(in[7]) };
+   Vec4 b2 = { _mm256_load_pd(in[8]), _mm256_load_pd(in[9]) };
+
+   // Relative velocity, and the parallelogram b sweeps relative to a
+   Vec4 vel = { _mm256_sub_pd(_mm256_load_pd(in[10]), _mm256_load_pd(in[4])),
+                _mm256_sub_pd(_mm256_load_pd(in[11]), _mm256_load_pd(in[5])) };
+   const __m256d t = _mm256_set1_pd((double) time);
+   Vec4 q1 = { _mm256_add_pd(b1.x, _mm256_mul_pd(vel.x, t)),
+               _mm256_add_pd(b1.y, _mm256_mul_pd(vel.y, t)) };
+   Vec4 q2 = { _mm256_add_pd(b2.x, _mm256_mul_pd(vel.x, t)),
+               _mm256_add_pd(b2.y, _mm256_mul_pd(vel.y, t)) };
+
+   const __m256d sign = _mm256_set1_pd(-0.0);
+   const __m256d threshold = _mm256_set1_pd(0.00007);
+   int still = _mm256_movemask_pd(_mm256_and_pd(
+         _mm256_cmp_pd(_mm256_andnot_pd(sign, vel.x), threshold, _CMP_LE_OQ),
+         _mm256_cmp_pd(_mm256_andnot_pd(sign, vel.y), threshold, _CMP_LE_OQ)));
+   int already = _mm256_movemask_pd(intersectLines4(a1, a2, b1, b2));
+   int across = _mm256_movemask_pd(intersectLines4(a1, a2, q1, q2));
+   int top = _mm256_movemask_pd(intersectLines4(a1, a2, q1, b1));
+   int bottom = _mm256_movemask_pd(intersectLines4(a1, a2, q2, b2));
+   int inside = _mm256_movemask_pd(_mm256_and_pd(
+         pointInParallelogram4(a1, b1, b2, q1, q2),
+         pointInParallelogram4(a2, b1, b2, q1, q2)));
+
+   for (int k = 0; k < 4; ++k) {
+      int bit = 1 << k;
+      int num_line_intersections = ((across & bit) != 0) +
+            ((top & bit) != 0) + ((bottom & bit) != 0);
+      if (still & bit) {
+         results[k] = NO_INTERSECTION;
+      } else if (already & bit) {
+         results[k] = ALREADY_INTERSECTED;
+      } else if (num_line_intersections == 2) {
+         results[k] = L2_WITH_L1;
+      } else if (inside & bit) {
+         results[k] = L1_WITH_L2;
+      } else if (num_line_intersections == 0) {
+         results[k] = NO_INTERSECTION;
+      } else {
+         results[k] = intersect(const_cast<Line *>(a[k]),
+                                const_cast<Line *>(b[k]), time);
+      }
+   }
+}
+#endif // __AVX2__ && !FIXED_POINT
+
+// Run intersect on line id against each of others[0, count), lower index
+// first, into results
+void intersectMany(const Line *lines, unsigned int id,
+                   const unsigned int *others, unsigned int count,
+                   int time, IntersectionType *results)
+{
+   unsigned int k = 0;
+#if defined(__AVX2__) && !defined(FIXED_POINT)
+   for (; k + 4 <= count; k += 4) {
+      const Line *a[4], *b[4];
+      for (int lane = 0; lane < 4; ++lane) {
+         unsigned int other = others[k + lane];
+         a[lane] = &lines[other < id ? other : id];
+         b[lane] = &lines[other < id ? id : other];
+      }
+      intersect4(a, b, time, results + k);
+   }
+#endif
+   for (; k < count; ++k) {
+      unsigned int other = others[k];
+      results[k] = intersect(const_cast<Line *>(&lines[other < id ? other : id]),
+                             const_cast<Line *>(&lines[other < id ? id : other]),
+                             time);
+   }
+}
+
 // Check if a point is in the parallelogram
-inline bool pointInParallelogram(Vec point,
-                          Vec p1, Vec p2,
-                          Vec p3, Vec p4)
+inline bool pointInParallelogram(Point point,
+                          Point p1, Point p2,
+                          Point p3, Point p4)
 {
-   double d1 = direction(p1, p2, point);
-   double d2 = direction(p3, p4, point);
-   double d3 = direction(p1, p3, point);
-   double d4 = direction(p2, p4, point);
+   Coord d1 = direction(p1, p2, point);
+   Coord d2 = direction(p3, p4, point);
+   Coord d3 = direction(p1, p3, point);
+   Coord d4 = direction(p2, p4, point);
 
    if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) &&
          ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0))) {
@@ -96,13 +267,13 @@ inline bool pointInParallelogram(Vec point,
 
 
 // Check if two lines are intersected
-bool intersectLines(Vec p1, Vec p2, Vec p3, Vec p4)
+bool intersectLines(Point p1, Point p2, Point p3, Point p4)
 {
    // Relative orientation
-   double d1 = direction(p3, p4, p1);
-   double d2 = direction(p3, p4, p2);
-   double d3 = direction(p1, p2, p3);
-   double d4 = direction(p1, p2, p4);
+   Coord d1 = direction(p3, p4, p1);
+   Coord d2 = direction(p3, p4, p2);
+   Coord d3 = direction(p1, p2, p3);
+   Coord d4 = direction(p1, p2, p4);
 
    // If (p1, p2) (p3, p4) straddle each other, the line segments must
    // intersect
@@ -139,17 +310,17 @@ Vec getIntersectionPoint(Vec p1, Vec p2, Vec p3, Vec p4)
 
 
 // Check the direction of two lines (pi, pj) and (pi, pk)
-inline double direction(Vec pi, Vec pj, Vec pk)
+inline Coord direction(Point pi, Point pj, Point pk)
 {
-   return crossProduct(pk.x - pi.x,
-                       pk.y - pi.y,
-                       pj.x - pi.x,
-                       pj.y - pi.y);
+   return crossProduct((Coord) pk.x - pi.x,
+                       (Coord) pk.y - pi.y,
+                       (Coord) pj.x - pi.x,
+                       (Coord) pj.y - pi.y);
 }
 
 
 // Check if a point pk is in the line segment (pi, pj)
-inline bool onSegment(Vec pi, Vec pj, Vec pk)
+inline bool onSegment(Point pi, Point pj, Point pk)
 {
    if (((pi.x <= pk.x && pk.x <= pj.x) ||
          (pj.x <= pk.x && pk.x <= pi.x)) &&
@@ -163,7 +334,7 @@ inline bool onSegment(Vec pi, Vec pj, Vec pk)
 
 
 // Calculate the cross product
-inline double crossProduct(double x1, double y1, double x2, double y2)
+inline Coord crossProduct(Coord x1, Coord y1, Coord x2, Coord y2)
 {
    return x1 * y2 - x2 * y1;
 }
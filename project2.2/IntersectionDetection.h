@@ -5,6 +5,32 @@
 #include "Vec.h"
 #include <cilk/cilk.h>
 
+#ifdef FIXED_POINT
+#include <stdint.h>
+
+// Built with FIXED_POINT defined, the intersection predicates truncate
+// points to fixed point numbers with FIXED_POINT_BITS fraction bits and
+// compute direction exactly in 64-bit integers.  Points must be within
+// (-2, 2) and those tested together less than 2 apart, as points near
+// the box always are.
+#define FIXED_POINT_BITS 30
+
+struct FixedVec {
+   int32_t x, y;
+   FixedVec() { }
+   FixedVec(Vec v)
+      : x((int32_t) (v.x * (double) (1 << FIXED_POINT_BITS))),
+        y((int32_t) (v.y * (double) (1 << FIXED_POINT_BITS))) { }
+};
+
+// Points, and coordinate differences, as the predicates see them
+typedef FixedVec Point;
+typedef int64_t Coord;
+#else
+typedef Vec Point;
+typedef double Coord;
+#endif
+
 typedef enum {NO_INTERSECTION, L1_WITH_L2, L2_WITH_L1,
               ALREADY_INTERSECTED
              } IntersectionType;
@@ -12,21 +38,30 @@ typedef enum {NO_INTERSECTION, L1_WITH_L2, L2_WITH_L1,
 // Detect if line l1 and l2 will be intersected in the next time step.
 IntersectionType intersect(Line *l1, Line *l2, int time);
 
+// Run intersect on line id of lines against each of the count lines
+// others[k], lower index first, storing the result in results[k].  Built
+// with AVX2, four candidates are tested at a time; the results are the
+// same as the scalar intersect's.  FIXED_POINT builds test them one
+// at a time.
+void intersectMany(const Line *lines, unsigned int id,
+                   const unsigned int *others, unsigned int count,
+                   int time, IntersectionType *results);
+
 // Check if a point is in the parallelogram.
-bool pointInParallelogram(Vec point, Vec p1, Vec p2,
-                          Vec p3, Vec p4);
+bool pointInParallelogram(Point point, Point p1, Point p2,
+                          Point p3, Point p4);
 
 // Check if two lines are intersected.
-bool intersectLines(Vec p1, Vec p2, Vec p3, Vec p4);
+bool intersectLines(Point p1, Point p2, Point p3, Point p4);
 
 // Check the direction of two lines (pi, pj) and (pi, pk)
-double direction(Vec pi, Vec pj, Vec pk);
+Coord direction(Point pi, Point pj, Point pk);
 
 // Check if a point pk is in the line segment (pi, pj)
-bool onSegment(Vec pi, Vec pj, Vec pk);
+bool onSegment(Point pi, Point pj, Point pk);
 
 // Calculate the cross product.
-double crossProduct(double x1, double y1, double x2, double y2);
+Coord crossProduct(Coord x1, Coord y1, Coord x2, Coord y2);
 
 // Obtain the intersection point for two intersecting line segments.
 Vec getIntersectionPoint(Vec p1, Vec p2, Vec p3, Vec p4);
@@ -1,5 +1,8 @@
 #include <stdlib.h>
 #include <iostream>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
 #include "Line.h"
 #include "LineDemo.h"
 
@@ -32,15 +35,110 @@ void lineMain(LineDemo *lineDemo)
 }
 
 
+// Wall clock time in seconds
+static double wallTime()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// The random scene of numLines lines, with the lengths and speeds of
+// options where they are not negative and the defaults otherwise
+static SceneParams makeScene(unsigned int numLines, const SceneParams &options)
+{
+   SceneParams params = LineDemo::defaultScene(numLines);
+   if (options.minLength >= 0) {
+      params.minLength = options.minLength;
+      params.maxLength = options.maxLength;
+   }
+   if (options.minSpeed >= 0) {
+      params.minSpeed = options.minSpeed;
+      params.maxSpeed = options.maxSpeed;
+   }
+   params.numClusters = options.numClusters;
+   params.clusterRadius = options.clusterRadius;
+   params.seed = options.seed;
+   return params;
+}
+
+// Run numFrames frames of a random scene of each size in sizes, printing
+// one row per size of frames per second, and of line pairs tested and
+// collisions per frame
+void benchmarkMain(const vector<unsigned int> &sizes, unsigned int numFrames,
+                   const SceneParams &options, Broadphase broadphase)
+{
+   printf("%10s %8s %10s %12s %12s %12s %12s\n", "lines", "frames",
+          "seconds", "frames/s", "tested/frm", "lineline/frm", "wall/frm");
+   for (unsigned int k = 0; k < sizes.size(); ++k) {
+      LineDemo *lineDemo = new LineDemo();
+      lineDemo->initRandomLine(makeScene(sizes[k], options));
+      lineDemo->setNumFrames(numFrames);
+      lineDemo->setBroadphase(broadphase);
+
+      double start = wallTime();
+      lineMain(lineDemo);
+      double seconds = wallTime() - start;
+
+      // lineMain runs numFrames + 1 updates
+      double frames = numFrames + 1;
+      printf("%10u %8u %10.3f %12.2f %12.0f %12.2f %12.2f\n",
+             sizes[k], numFrames + 1, seconds, frames / seconds,
+             lineDemo->getNumPairsTested() / frames,
+             lineDemo->getNumLineLineCollisions() / frames,
+             lineDemo->getNumLineWallCollisions() / frames);
+      fflush(stdout);
+      delete lineDemo;
+   }
+}
+
+
 int main(int argc, char** argv)
 {
    int optchar;
    bool graphicDemoFlag = false, imageOnlyFlag = false;
    unsigned int numFrames = 1;
+   Broadphase broadphase = QUADTREE_BROADPHASE;
+   bool benchmarkFlag = false;
+   unsigned int numLines = 0;
+   SceneParams options = LineDemo::defaultScene(0);
+   options.minLength = options.maxLength = -1;
+   options.minSpeed = options.maxSpeed = -1;
 
    // process command line options
-   while ((optchar = getopt(argc, argv, "gi")) != -1) {
+   while ((optchar = getopt(argc, argv, "gib:Bn:l:v:c:r:s:")) != -1) {
       switch (optchar) {
+         case 'B':
+            benchmarkFlag = true;
+            break;
+         case 'n':
+            numLines = atoi(optarg);
+            break;
+         case 'l':
+            if (sscanf(optarg, "%lf,%lf", &options.minLength, &options.maxLength) != 2 ||
+                options.minLength < 0 || options.maxLength < options.minLength ||
+                options.maxLength > MAX_LINE_LENGTH) {
+               cout << "Bad line lengths: " << optarg
+                    << " (at most " << MAX_LINE_LENGTH << " pixels)" << endl;
+               exit(-1);
+            }
+            break;
+         case 'v':
+            if (sscanf(optarg, "%lf,%lf", &options.minSpeed, &options.maxSpeed) != 2 ||
+                options.minSpeed < 0 || options.maxSpeed < options.minSpeed) {
+               cout << "Bad line speeds: " << optarg << endl;
+               exit(-1);
+            }
+            break;
+         case 'c':
+            options.numClusters = atoi(optarg);
+            break;
+         case 'r':
+            options.clusterRadius = atof(optarg);
+            break;
+         case 's':
+            options.seed = atoi(optarg);
+            break;
          case 'g':
             graphicDemoFlag = true;
             break;
@@ -48,6 +146,18 @@ int main(int argc, char** argv)
             imageOnlyFlag = true;
             graphicDemoFlag = true;
             break;
+         case 'b':
+            if (strcmp(optarg, "quadtree") == 0) {
+               broadphase = QUADTREE_BROADPHASE;
+            } else if (strcmp(optarg, "grid") == 0) {
+               broadphase = GRID_BROADPHASE;
+            } else if (strcmp(optarg, "sweep") == 0) {
+               broadphase = SWEEP_BROADPHASE;
+            } else {
+               cout << "Unknown broadphase: " << optarg << endl;
+               exit(-1);
+            }
+            break;
          default:
             cout << "Ignoring unrecognized option: " << optchar << endl;
             continue;
@@ -63,9 +173,18 @@ int main(int argc, char** argv)
 
       // check to make sure number of arguments is correct
       if (remaining_args != 1) {
-         cout << "Usage: " << argv[0] << " [-g] [-i] <numFrames>" << endl;
+         cout << "Usage: " << argv[0] << " [-g] [-i] [-b broadphase] [-B] [-n lines]" << endl
+              << "       [-l min,max] [-v min,max] [-c clusters] [-r radius] [-s seed] <numFrames>" << endl;
          cout << "  -g : show graphics" << endl;
          cout << "  -i : show first image only (ignore numFrames)" << endl;
+         cout << "  -b : quadtree (default), grid or sweep" << endl;
+         cout << "  -B : benchmark random scenes of 1k to 1M lines (or -n lines)" << endl;
+         cout << "  -n : simulate a random scene of this many lines, not line.in" << endl;
+         cout << "  -l : line lengths of the random scene, in pixels" << endl;
+         cout << "  -v : line speeds of the random scene, in pixels per frame" << endl;
+         cout << "  -c : cluster the random scene around this many points" << endl;
+         cout << "  -r : radius of the clusters, in pixels (default 100)" << endl;
+         cout << "  -s : random seed of the scene (default 1)" << endl;
          exit(-1);
       }
 
@@ -73,10 +192,28 @@ int main(int argc, char** argv)
       cout << "Number of frames = " << numFrames << endl;
    }
 
+   if (benchmarkFlag) {
+      vector<unsigned int> sizes;
+      if (numLines > 0) {
+         sizes.push_back(numLines);
+      } else {
+         for (unsigned int n = 1000; n <= 1000000; n *= 10) {
+            sizes.push_back(n);
+         }
+      }
+      benchmarkMain(sizes, numFrames, options, broadphase);
+      return 0;
+   }
+
    // Create and initialize the Line simulation environment
    LineDemo *lineDemo = new LineDemo();
-   lineDemo->initLine();
+   if (numLines > 0) {
+      lineDemo->initRandomLine(makeScene(numLines, options));
+   } else {
+      lineDemo->initLine();
+   }
    lineDemo->setNumFrames(numFrames);
+   lineDemo->setBroadphase(broadphase);
 
 #ifndef PROFILE_BUILD
    // start cilkview performance analysis
@@ -101,6 +238,10 @@ int main(int argc, char** argv)
         << " Line-Wall Collisions" << endl;
    cout << lineDemo->getNumLineLineCollisions()
         << " Line-Line Collisions" << endl;
+   cout << lineDemo->getNumPairsTested()
+        << " Line Pairs Tested" << endl;
+   cout << lineDemo->getNumPairsRejected()
+        << " Line Pairs Rejected" << endl;
 
 #ifndef PROFILE_BUILD
    cout << (end.time - start.time) / 1000.0
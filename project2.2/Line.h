@@ -18,6 +18,9 @@
 #define WINDOW_WIDTH 1180
 #define WINDOW_HEIGHT 800
 
+// longest line that fits in the window whatever its direction
+#define MAX_LINE_LENGTH (WINDOW_WIDTH < WINDOW_HEIGHT ? WINDOW_WIDTH : WINDOW_HEIGHT)
+
 struct Line {
    Vec p1;
    Vec p2;
@@ -6,10 +6,14 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <math.h>
 
 #include "Line.h"
 #include "LineDemo.h"
 
+// Random placements of a line tried before centring it in the window
+#define MAX_PLACEMENT_TRIES 1000
+
 // The main simulation loop
 bool LineDemo::update()
 {
@@ -54,6 +58,68 @@ void LineDemo::createLines()
 }
 
 
+// Add the lines of a random scene, drawn with drand48 from params.seed
+void LineDemo::createRandomLines(const SceneParams &params)
+{
+   srand48(params.seed);
+
+   vector<double> clusterX(params.numClusters), clusterY(params.numClusters);
+   for (unsigned int c = 0; c < params.numClusters; ++c) {
+      clusterX[c] = drand48() * WINDOW_WIDTH;
+      clusterY[c] = drand48() * WINDOW_HEIGHT;
+   }
+
+   for (unsigned int i = 0; i < params.numLines; ++i) {
+      double length = params.minLength +
+            drand48() * (params.maxLength - params.minLength);
+      if (length > MAX_LINE_LENGTH)
+         length = MAX_LINE_LENGTH;
+      double px1, py1, px2, py2;
+
+      // Draw the centre and direction until the line fits in the window.
+      // A cluster may lie too near a corner to hold the line, so after
+      // MAX_PLACEMENT_TRIES draws centre it in the window, where a line
+      // no longer than MAX_LINE_LENGTH fits in any direction
+      for (unsigned int tries = 0; ; ++tries) {
+         double cx, cy;
+         if (tries >= MAX_PLACEMENT_TRIES) {
+            cx = 0.5 * WINDOW_WIDTH;
+            cy = 0.5 * WINDOW_HEIGHT;
+         } else if (params.numClusters == 0) {
+            cx = drand48() * WINDOW_WIDTH;
+            cy = drand48() * WINDOW_HEIGHT;
+         } else {
+            unsigned int c = lrand48() % params.numClusters;
+            double r = params.clusterRadius * sqrt(drand48());
+            double a = 2 * M_PI * drand48();
+            cx = clusterX[c] + r * cos(a);
+            cy = clusterY[c] + r * sin(a);
+         }
+         double a = 2 * M_PI * drand48();
+         double dx = 0.5 * length * cos(a), dy = 0.5 * length * sin(a);
+         px1 = cx - dx; py1 = cy - dy;
+         px2 = cx + dx; py2 = cy + dy;
+         if (px1 >= 0 && px1 <= WINDOW_WIDTH && px2 >= 0 && px2 <= WINDOW_WIDTH &&
+             py1 >= 0 && py1 <= WINDOW_HEIGHT && py2 >= 0 && py2 <= WINDOW_HEIGHT)
+            break;
+      }
+
+      double speed = params.minSpeed +
+            drand48() * (params.maxSpeed - params.minSpeed);
+      double a = 2 * M_PI * drand48();
+
+      Line *line = new Line;
+      windowToBox(&line->p1.x, &line->p1.y, px1, py1);
+      windowToBox(&line->p2.x, &line->p2.y, px2, py2);
+      velocityWindowToBox(&line->vel.x, &line->vel.y,
+                          speed * cos(a), speed * sin(a));
+      line->isGray = lrand48() % 2;
+
+      collisionWorld->addLine(line);
+   }
+}
+
+
 // Delete all the lines in collision world at end of simulation
 void LineDemo::deleteLines()
 {
@@ -80,11 +146,38 @@ void LineDemo::setNumFrames(unsigned int _numFrames)
   numFrames = _numFrames;
 }
 
+void LineDemo::setBroadphase(Broadphase broadphase)
+{
+  collisionWorld->setBroadphase(broadphase);
+}
+
 void LineDemo::initLine()
 {
    createLines();
 }
 
+void LineDemo::initRandomLine(const SceneParams &params)
+{
+   createRandomLines(params);
+}
+
+SceneParams LineDemo::defaultScene(unsigned int numLines)
+{
+   // line.in has about 800 lines, 35 pixels long and moving 0.25 pixels
+   // per frame on average
+   double scale = sqrt(800.0 / (numLines > 0 ? numLines : 1));
+   SceneParams params;
+   params.numLines = numLines;
+   params.minLength = 10 * scale;
+   params.maxLength = 60 * scale;
+   params.minSpeed = 0;
+   params.maxSpeed = 0.5;
+   params.numClusters = 0;
+   params.clusterRadius = 100;
+   params.seed = 1;
+   return params;
+}
+
 Line *LineDemo::getLine(unsigned int index)
 {
    return collisionWorld->getLine(index);
@@ -104,3 +197,13 @@ unsigned int LineDemo::getNumLineLineCollisions()
 {
    return collisionWorld->getNumLineLineCollisions();
 }
+
+unsigned long long LineDemo::getNumPairsTested()
+{
+   return collisionWorld->getNumPairsTested();
+}
+
+unsigned long long LineDemo::getNumPairsRejected()
+{
+   return collisionWorld->getNumPairsRejected();
+}
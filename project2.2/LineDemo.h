@@ -6,6 +6,21 @@
 
 using namespace std;
 
+// A randomly generated scene.  Lengths and speeds are in window pixels,
+// and per frame for speeds.
+struct SceneParams {
+   unsigned int numLines;
+   double minLength, maxLength;   // lengths are uniform in this range,
+                                  // clamped to MAX_LINE_LENGTH
+   double minSpeed, maxSpeed;     // speeds are uniform in this range,
+                                  // in a uniformly random direction
+   unsigned int numClusters;      // 0 spreads the lines uniformly, else
+                                  // their centres are within clusterRadius
+                                  // of one of numClusters random points
+   double clusterRadius;
+   unsigned int seed;
+};
+
 class LineDemo
 {
 protected:
@@ -21,6 +36,9 @@ protected:
    // Add lines for line simulation at beginning
    void createLines();
 
+   // Add the lines of a random scene
+   void createRandomLines(const SceneParams &params);
+
    // Remove lines from line simulation at the end
    void deleteLines();
 
@@ -35,9 +53,24 @@ public:
    // Set number of frames to compute
    void setNumFrames(unsigned int _numFrames);
 
+   // Set the broadphase used to find candidate collisions
+   void setBroadphase(Broadphase broadphase);
+
    // Initialize line simulation
    void initLine();
 
+   // Initialize line simulation with a random scene instead of line.in
+   void initRandomLine(const SceneParams &params);
+
+   // Default scene of numLines uniformly spread lines.  Line lengths
+   // shrink as 1/sqrt(numLines) from those of line.in, so the number of
+   // lines near each line, and the broadphase's candidates per line, stay
+   // about the same whatever the size of the scene.  Speeds don't shrink
+   // (intersect ignores slow relative motion), so in a frame a line sweeps
+   // past more of its shorter neighbours: collisions per line per frame
+   // are not constant but grow with numLines, at most as sqrt(numLines).
+   static SceneParams defaultScene(unsigned int numLines);
+
    // Get i-th line
    Line *getLine(unsigned int index);
 
@@ -50,6 +83,12 @@ public:
    // Get number of line-line collisions
    unsigned int getNumLineLineCollisions();
 
+   // Get number of line pairs tested with intersect
+   unsigned long long getNumPairsTested();
+
+   // Get number of line pairs rejected by their swept boxes
+   unsigned long long getNumPairsRejected();
+
    // Line simulation update function
    bool update();
 };
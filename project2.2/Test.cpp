@@ -1,6 +1,9 @@
 #include "IntersectionDetection.h"
+#include "LineDemo.h"
 #include "gtest/gtest.h"
 
+#include <stdlib.h>
+
 // Anonymous namespaces are a C++ idiom for declaring symbols to be
 // file-private, ie not exported, like declaring a function static in straight C.
 namespace {
@@ -36,6 +39,54 @@ TEST_F(IntersectionDetectionTest, parallelLinesDontIntersect) {
   EXPECT_FALSE(intersectLines(p1, p2, p3, p4));
 }
 
+// Lines on a coarse grid, so that touching and collinear cases come up
+TEST_F(IntersectionDetectionTest, intersectManyMatchesIntersect) {
+  const unsigned int numLines = 203;
+  Line lines[numLines];
+  unsigned int others[numLines];
+  IntersectionType results[numLines];
+  srand(1);
+  for (unsigned int i = 0; i < numLines; ++i) {
+    lines[i].p1 = Vec(rand() % 16 / 16.0, rand() % 16 / 16.0);
+    lines[i].p2 = Vec(rand() % 16 / 16.0, rand() % 16 / 16.0);
+    lines[i].vel = Vec(rand() % 5 / 32.0 - 0.0625, rand() % 5 / 32.0 - 0.0625);
+    lines[i].isGray = false;
+    others[i] = i;
+  }
+  for (unsigned int id = 0; id < numLines; ++id) {
+    intersectMany(lines, id, others, numLines, 1, results);
+    for (unsigned int k = 0; k < numLines; ++k) {
+      if (k == id) continue;
+      Line *l1 = &lines[k < id ? k : id];
+      Line *l2 = &lines[k < id ? id : k];
+      EXPECT_EQ(intersect(l1, l2, 1), results[k]) << id << " " << k;
+    }
+  }
+}
+
+// Collision counts after 1000 frames of line.in, as simulated with the
+// double predicates.  These must match exactly; FIXED_POINT builds round
+// positions differently, so there the counts only have to be within 1%.
+TEST(LineDemoTest, lineInCollisionCounts) {
+  const unsigned int wallCollisions = 171;
+  const unsigned int lineCollisions = 1850;
+  LineDemo *lineDemo = new LineDemo();
+  lineDemo->initLine();
+  lineDemo->setNumFrames(1000);
+  while (lineDemo->update()) {
+  }
+#ifndef FIXED_POINT
+  EXPECT_EQ(wallCollisions, lineDemo->getNumLineWallCollisions());
+  EXPECT_EQ(lineCollisions, lineDemo->getNumLineLineCollisions());
+#else
+  EXPECT_NEAR(wallCollisions, lineDemo->getNumLineWallCollisions(),
+              0.01 * wallCollisions);
+  EXPECT_NEAR(lineCollisions, lineDemo->getNumLineLineCollisions(),
+              0.01 * lineCollisions);
+#endif
+  delete lineDemo;
+}
+
 }  // namespace
 
 int main(int argc, char **argv) {